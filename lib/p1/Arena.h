@@ -0,0 +1,173 @@
+//**********************************************************************
+// An Arena is a bump allocator that owns all of the analysis storage
+// for one function.  Nothing allocated from it is freed individually;
+// reset() rewinds it in O(1) so the next function reuses the same
+// slabs.  Since slabs are kept rather than freed, the memory held by
+// an Arena is bounded by the largest function seen, not by the number
+// of functions.
+//
+// ArenaAllocator<T> adapts an Arena to the STL allocator interface, so
+// std containers of per-function data can live in the arena too.
+// Containers that use it must be destroyed (or cleared) before the
+// arena is reset.
+//**********************************************************************
+
+#ifndef P1_ARENA_H
+#define P1_ARENA_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <vector>
+#include <new>
+
+class Arena {
+public:
+  explicit Arena(size_t slabSize = 64 * 1024)
+    : slabSize(slabSize), curSlab(0), cur(0), end(0) {}
+
+  ~Arena() {
+    for (unsigned i = 0; i < slabs.size(); i++)
+      free(slabs[i].start);
+  }
+
+  //**********************************************************************
+  // allocate
+  //
+  // return size bytes aligned to align (a power of two)
+  //**********************************************************************
+  void *allocate(size_t size, size_t align) {
+    char *p = alignPtr(cur, align);
+    if (cur == 0 || p + size > end) {
+      nextSlab(size + align);
+      p = alignPtr(cur, align);
+    }
+    cur = p + size;
+    return p;
+  }
+
+  template<class T> T *allocateArray(size_t n) {
+    return static_cast<T *>(allocate(n * sizeof(T), sizeof(void *)));
+  }
+
+  //**********************************************************************
+  // reset
+  //
+  // forget everything allocated so far; keeps the slabs for reuse
+  //**********************************************************************
+  void reset() {
+    curSlab = 0;
+    if (slabs.empty()) {
+      cur = end = 0;
+    } else {
+      cur = slabs[0].start;
+      end = slabs[0].end;
+    }
+  }
+
+  // total bytes held in slabs (for statistics)
+  size_t getBytesReserved() const {
+    size_t total = 0;
+    for (unsigned i = 0; i < slabs.size(); i++)
+      total += slabs[i].end - slabs[i].start;
+    return total;
+  }
+
+private:
+  struct Slab {
+    char *start;
+    char *end;
+  };
+
+  size_t slabSize;
+  std::vector<Slab> slabs;
+  unsigned curSlab;   // index of the slab cur points into
+  char *cur;
+  char *end;
+
+  static char *alignPtr(char *p, size_t align) {
+    return (char *)(((size_t)p + align - 1) & ~(align - 1));
+  }
+
+  // move cur to a slab with at least minSize free bytes, reusing a
+  // slab from before the last reset when one is big enough
+  void nextSlab(size_t minSize) {
+    unsigned next = (cur == 0) ? 0 : curSlab + 1;
+    while (next < slabs.size() &&
+           (size_t)(slabs[next].end - slabs[next].start) < minSize)
+      next++;
+    if (next >= slabs.size()) {
+      size_t size = minSize > slabSize ? minSize : slabSize;
+      Slab s;
+      s.start = (char *)malloc(size);
+      if (s.start == 0)
+        throw std::bad_alloc();
+      s.end = s.start + size;
+      slabs.push_back(s);
+      next = slabs.size() - 1;
+    }
+    curSlab = next;
+    cur = slabs[next].start;
+    end = slabs[next].end;
+  }
+
+  Arena(const Arena &);            // do not implement
+  void operator=(const Arena &);   // do not implement
+};
+
+inline void *operator new(size_t size, Arena &A) {
+  return A.allocate(size, sizeof(void *));
+}
+
+inline void operator delete(void *, Arena &) {
+}
+
+template<class T>
+class ArenaAllocator {
+public:
+  typedef T value_type;
+  typedef T *pointer;
+  typedef const T *const_pointer;
+  typedef T &reference;
+  typedef const T &const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+
+  template<class U> struct rebind {
+    typedef ArenaAllocator<U> other;
+  };
+
+  explicit ArenaAllocator(Arena &A) : arena(&A) {}
+  template<class U>
+  ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.getArena()) {}
+
+  pointer address(reference x) const { return &x; }
+  const_pointer address(const_reference x) const { return &x; }
+
+  pointer allocate(size_type n, const void * = 0) {
+    return arena->allocateArray<T>(n);
+  }
+
+  // memory is reclaimed all at once by Arena::reset
+  void deallocate(pointer, size_type) {}
+
+  size_type max_size() const { return size_type(-1) / sizeof(T); }
+
+  void construct(pointer p, const T &val) { new ((void *)p) T(val); }
+  void destroy(pointer p) { p->~T(); }
+
+  Arena *getArena() const { return arena; }
+
+  template<class U>
+  bool operator==(const ArenaAllocator<U> &other) const {
+    return arena == other.getArena();
+  }
+  template<class U>
+  bool operator!=(const ArenaAllocator<U> &other) const {
+    return arena != other.getArena();
+  }
+
+private:
+  Arena *arena;
+};
+
+#endif
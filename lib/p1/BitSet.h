@@ -0,0 +1,205 @@
+//**********************************************************************
+// A BitSet is a fixed-size packed bit vector over a dense index space.
+// The dataflow analyses renumber registers (and other facts) into
+// 0..N-1 once per function and keep every set as a BitSet, so unions,
+// subtractions and the gen/kill transfer function work a word at a time.
+//
+// The words of a BitSet live in the function's Arena; copies allocate
+// from the same arena, and nothing is freed until the arena is reset.
+//**********************************************************************
+
+#ifndef P1_BITSET_H
+#define P1_BITSET_H
+
+#include "Arena.h"
+#include <cstring>
+#include <stdint.h>
+
+class BitSet {
+public:
+  typedef uint64_t Word;
+  static const unsigned BITS_PER_WORD = 64;
+
+  BitSet() : arena(0), words(0), numBits(0), numWords(0) {}
+
+  // an empty set over n bits
+  BitSet(unsigned n, Arena &A) : arena(&A) {
+    allocate(n);
+    clear();
+  }
+
+  BitSet(const BitSet &S) : arena(S.arena) {
+    allocate(S.numBits);
+    copyWords(S);
+  }
+
+  BitSet &operator=(const BitSet &S) {
+    if (this == &S)
+      return *this;
+    if (numBits != S.numBits || words == 0) {
+      arena = S.arena;
+      allocate(S.numBits);
+    }
+    copyWords(S);
+    return *this;
+  }
+
+  unsigned size() const { return numBits; }
+
+  // grow to n >= size() bits, keeping the contents; the new bits are
+  // clear.  The old words stay in the arena.
+  void grow(unsigned n) {
+    Word *old = words;
+    unsigned oldWords = numWords;
+    allocate(n);
+    if (oldWords)
+      memcpy(words, old, oldWords * sizeof(Word));
+    if (numWords > oldWords)
+      memset(words + oldWords, 0, (numWords - oldWords) * sizeof(Word));
+  }
+
+  bool test(unsigned i) const {
+    return (words[i / BITS_PER_WORD] >> (i % BITS_PER_WORD)) & 1;
+  }
+
+  void set(unsigned i) {
+    words[i / BITS_PER_WORD] |= Word(1) << (i % BITS_PER_WORD);
+  }
+
+  void reset(unsigned i) {
+    words[i / BITS_PER_WORD] &= ~(Word(1) << (i % BITS_PER_WORD));
+  }
+
+  // clear all bits, keeping the size
+  void clear() {
+    if (numWords)
+      memset(words, 0, numWords * sizeof(Word));
+  }
+
+  // set all bits, keeping the bits past size() clear
+  void setAll() {
+    if (numWords == 0)
+      return;
+    memset(words, 0xff, numWords * sizeof(Word));
+    if (numBits % BITS_PER_WORD)
+      words[numWords - 1] = (Word(1) << (numBits % BITS_PER_WORD)) - 1;
+  }
+
+  bool empty() const {
+    for (unsigned w = 0, e = numWords; w != e; ++w)
+      if (words[w])
+        return false;
+    return true;
+  }
+
+  unsigned count() const {
+    unsigned n = 0;
+    for (unsigned w = 0, e = numWords; w != e; ++w)
+      n += __builtin_popcountll(words[w]);
+    return n;
+  }
+
+  //**********************************************************************
+  // unionWith
+  //
+  // *this |= S; return true iff *this changed
+  //**********************************************************************
+  bool unionWith(const BitSet &S) {
+    Word changed = 0;
+    for (unsigned w = 0, e = numWords; w != e; ++w) {
+      Word old = words[w];
+      words[w] = old | S.words[w];
+      changed |= old ^ words[w];
+    }
+    return changed != 0;
+  }
+
+  //**********************************************************************
+  // intersectWith
+  //
+  // *this &= S; return true iff *this changed
+  //**********************************************************************
+  bool intersectWith(const BitSet &S) {
+    Word changed = 0;
+    for (unsigned w = 0, e = numWords; w != e; ++w) {
+      Word old = words[w];
+      words[w] = old & S.words[w];
+      changed |= old ^ words[w];
+    }
+    return changed != 0;
+  }
+
+  //**********************************************************************
+  // subtract
+  //
+  // *this -= S
+  //**********************************************************************
+  void subtract(const BitSet &S) {
+    for (unsigned w = 0, e = numWords; w != e; ++w)
+      words[w] &= ~S.words[w];
+  }
+
+  //**********************************************************************
+  // assignTransfer
+  //
+  // *this = (in - kill) union gen; return true iff *this changed
+  //**********************************************************************
+  bool assignTransfer(const BitSet &in, const BitSet &kill, const BitSet &gen) {
+    Word changed = 0;
+    for (unsigned w = 0, e = numWords; w != e; ++w) {
+      Word old = words[w];
+      words[w] = (in.words[w] & ~kill.words[w]) | gen.words[w];
+      changed |= old ^ words[w];
+    }
+    return changed != 0;
+  }
+
+  // return the index of the first set bit, or -1 if there is none
+  int findFirst() const { return findFrom(0); }
+
+  // return the index of the first set bit after prev, or -1
+  int findNext(unsigned prev) const { return findFrom(prev + 1); }
+
+  bool operator==(const BitSet &S) const {
+    return numBits == S.numBits &&
+      (numWords == 0 || memcmp(words, S.words, numWords * sizeof(Word)) == 0);
+  }
+  bool operator!=(const BitSet &S) const { return !(*this == S); }
+
+private:
+  Arena *arena;
+  Word *words;
+  unsigned numBits;
+  unsigned numWords;
+
+  static unsigned numWordsFor(unsigned n) {
+    return (n + BITS_PER_WORD - 1) / BITS_PER_WORD;
+  }
+
+  void allocate(unsigned n) {
+    numBits = n;
+    numWords = numWordsFor(n);
+    words = (numWords && arena) ? arena->allocateArray<Word>(numWords) : 0;
+  }
+
+  void copyWords(const BitSet &S) {
+    if (numWords)
+      memcpy(words, S.words, numWords * sizeof(Word));
+  }
+
+  int findFrom(unsigned i) const {
+    if (i >= numBits)
+      return -1;
+    unsigned w = i / BITS_PER_WORD;
+    Word cur = words[w] & (~Word(0) << (i % BITS_PER_WORD));
+    while (true) {
+      if (cur)
+        return w * BITS_PER_WORD + __builtin_ctzll(cur);
+      if (++w == numWords)
+        return -1;
+      cur = words[w];
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,477 @@
+//**********************************************************************
+// An iterative dataflow solver over bit-vector lattices, shared by the
+// IR passes (Function / BasicBlock / Instruction) and the register
+// allocator (MachineFunction / MachineBasicBlock / MachineInstr).
+//
+// A DataFlow<GraphT, ProblemT> is parameterized on
+//   GraphT:   a DataFlowGraph<FunctionT>, which numbers the blocks of a
+//             function densely and gives their successors, predecessors
+//             and instructions
+//   ProblemT: the analysis, which provides
+//               static const DataFlowDirection direction;
+//               static const DataFlowMeet meet;
+//               unsigned getNumFacts();
+//               void getBlockGenKill(BlockT *bb, BitSet &gen, BitSet &kill);
+//               void transfer(InstrT *inst, BitSet &S);
+//             where facts are dense indexes 0..getNumFacts()-1, gen and
+//             kill arrive empty, and transfer applies one instruction's
+//             effect to S in the problem's direction.
+//
+// solve() finds the block-level fixed point using only the block gen and
+// kill sets, so each visit is one word-wide (in - kill) | gen.  The
+// instruction-level sets are not stored; refineBlock() recomputes them
+// for one block on demand from the block's boundary set and transfer(),
+// and an InstrSetCache answers queries about single instructions that
+// way, keeping the sets of only a few recently used blocks.
+//
+// Blocks without predecessors (forward) or successors (backward) start
+// from the empty set; for an intersection meet every other set starts
+// full.
+//**********************************************************************
+
+#ifndef P1_DATAFLOW_H
+#define P1_DATAFLOW_H
+
+#include "BitSet.h"
+#include "Arena.h"
+#include "llvm/Function.h"
+#include "llvm/BasicBlock.h"
+#include "llvm/Instruction.h"
+#include "llvm/Support/CFG.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/CodeGen/MachineFunction.h"
+#include "llvm/CodeGen/MachineBasicBlock.h"
+#include "llvm/CodeGen/MachineInstr.h"
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+using namespace llvm;
+
+enum DataFlowDirection { FORWARD, BACKWARD };
+enum DataFlowMeet { MEET_UNION, MEET_INTERSECTION };
+
+template<class FunctionT> class DataFlowGraph;
+
+//**********************************************************************
+// DataFlowGraph<MachineFunction>: blocks are numbered by LLVM already
+//**********************************************************************
+template<> class DataFlowGraph<MachineFunction> {
+public:
+  typedef MachineBasicBlock BlockT;
+  typedef MachineInstr InstrT;
+  typedef MachineFunction::iterator block_iterator;
+  typedef MachineBasicBlock::iterator instr_iterator;
+  typedef MachineBasicBlock::succ_iterator succ_iterator;
+  typedef MachineBasicBlock::pred_iterator pred_iterator;
+
+  explicit DataFlowGraph(MachineFunction &F) : Fn(F) {}
+
+  block_iterator block_begin() { return Fn.begin(); }
+  block_iterator block_end() { return Fn.end(); }
+  unsigned getNumBlocks() const { return Fn.getNumBlockIDs(); }
+  unsigned getNumber(BlockT *bb) const { return bb->getNumber(); }
+
+  static succ_iterator succ_begin(BlockT *bb) { return bb->succ_begin(); }
+  static succ_iterator succ_end(BlockT *bb) { return bb->succ_end(); }
+  static pred_iterator pred_begin(BlockT *bb) { return bb->pred_begin(); }
+  static pred_iterator pred_end(BlockT *bb) { return bb->pred_end(); }
+  static instr_iterator instr_begin(BlockT *bb) { return bb->begin(); }
+  static instr_iterator instr_end(BlockT *bb) { return bb->end(); }
+  static BlockT *getParent(InstrT *I) { return I->getParent(); }
+
+private:
+  MachineFunction &Fn;
+};
+
+//**********************************************************************
+// DataFlowGraph<Function>: IR blocks have no numbers, so number them in
+// layout order
+//**********************************************************************
+template<> class DataFlowGraph<Function> {
+public:
+  typedef BasicBlock BlockT;
+  typedef Instruction InstrT;
+  typedef Function::iterator block_iterator;
+  typedef BasicBlock::iterator instr_iterator;
+  typedef llvm::succ_iterator succ_iterator;
+  typedef llvm::pred_iterator pred_iterator;
+
+  explicit DataFlowGraph(Function &F) : Fn(F) {
+    unsigned n = 0;
+    for (Function::iterator b = F.begin(), e = F.end(); b != e; ++b)
+      numbers[&*b] = n++;
+  }
+
+  block_iterator block_begin() { return Fn.begin(); }
+  block_iterator block_end() { return Fn.end(); }
+  unsigned getNumBlocks() const { return numbers.size(); }
+  unsigned getNumber(BlockT *bb) const { return numbers.lookup(bb); }
+
+  static succ_iterator succ_begin(BlockT *bb) { return llvm::succ_begin(bb); }
+  static succ_iterator succ_end(BlockT *bb) { return llvm::succ_end(bb); }
+  static pred_iterator pred_begin(BlockT *bb) { return llvm::pred_begin(bb); }
+  static pred_iterator pred_end(BlockT *bb) { return llvm::pred_end(bb); }
+  static instr_iterator instr_begin(BlockT *bb) { return bb->begin(); }
+  static instr_iterator instr_end(BlockT *bb) { return bb->end(); }
+  static BlockT *getParent(InstrT *I) { return I->getParent(); }
+
+private:
+  Function &Fn;
+  DenseMap<const BasicBlock *, unsigned> numbers;
+};
+
+//**********************************************************************
+// BlockWorklist
+//
+// A worklist of basic blocks that hands blocks out in a fixed priority
+// order: postorder for backward problems (a block after its successors)
+// or reverse postorder for forward ones (a block after its
+// predecessors).  Membership is a bit per priority, so pushing a block
+// already on the list is free, and pop sweeps the bits upwards from the
+// last block popped, wrapping around; each wrap starts a new pass.  On
+// reducible CFGs the number of passes is bounded by the loop nesting
+// depth plus a small constant.
+//**********************************************************************
+template<class GraphT>
+class BlockWorklist {
+public:
+  typedef typename GraphT::BlockT BlockT;
+
+  // put every block of G on the list
+  BlockWorklist(GraphT &G, DataFlowDirection dir, Arena &A)
+    : graph(G), cursor(-1), numPops(0), numPasses(1)
+  {
+    computePostorder();
+    if (dir == FORWARD)
+      reverse(order.begin(), order.end());
+    priority.assign(graph.getNumBlocks(), 0);
+    for (unsigned i = 0; i < order.size(); i++)
+      priority[graph.getNumber(order[i])] = i;
+    onList = BitSet(order.size(), A);
+    onList.setAll();
+  }
+
+  bool empty() const { return onList.empty(); }
+
+  void push(BlockT *bb) { onList.set(priority[graph.getNumber(bb)]); }
+
+  BlockT *pop() {
+    int next = cursor == -1 ? onList.findFirst() : onList.findNext(cursor);
+    if (next == -1) {
+      next = onList.findFirst();
+      numPasses++;
+    }
+    onList.reset(next);
+    cursor = next;
+    numPops++;
+    return order[next];
+  }
+
+  // blocks visited, and sweeps over the priority order, so far
+  unsigned getNumPops() const { return numPops; }
+  unsigned getNumPasses() const { return numPasses; }
+
+private:
+  GraphT &graph;
+  vector<BlockT *> order;     // by priority
+  vector<unsigned> priority;  // by block number
+  BitSet onList;              // by priority
+  int cursor;
+  unsigned numPops, numPasses;
+
+  // depth-first postorder from the entry block; blocks that cannot be
+  // reached from the entry go last
+  void computePostorder() {
+    typedef typename GraphT::succ_iterator succ_iterator;
+    vector<bool> visited(graph.getNumBlocks(), false);
+    vector<pair<BlockT *, succ_iterator> > stack;
+    for (typename GraphT::block_iterator b = graph.block_begin(),
+           e = graph.block_end(); b != e; ++b) {
+      BlockT *root = &*b;
+      if (visited[graph.getNumber(root)])
+        continue;
+      visited[graph.getNumber(root)] = true;
+      stack.push_back(make_pair(root, GraphT::succ_begin(root)));
+      while (!stack.empty()) {
+        BlockT *bb = stack.back().first;
+        if (stack.back().second == GraphT::succ_end(bb)) {
+          order.push_back(bb);
+          stack.pop_back();
+          continue;
+        }
+        BlockT *succ = *stack.back().second;
+        ++stack.back().second;
+        if (!visited[graph.getNumber(succ)]) {
+          visited[graph.getNumber(succ)] = true;
+          stack.push_back(make_pair(succ, GraphT::succ_begin(succ)));
+        }
+      }
+    }
+  }
+};
+
+//**********************************************************************
+// DataFlow
+//**********************************************************************
+template<class GraphT, class ProblemT>
+class DataFlow {
+public:
+  typedef typename GraphT::BlockT BlockT;
+  typedef typename GraphT::InstrT InstrT;
+
+  DataFlow(GraphT &G, ProblemT &P, Arena &A)
+    : graph(G), problem(P), arena(A), numPops(0), numPasses(0) {}
+
+  //**********************************************************************
+  // solve
+  //
+  // compute the before and after sets of every block
+  //**********************************************************************
+  void solve() {
+    unsigned numBlocks = graph.getNumBlocks();
+    BitSet empty(problem.getNumFacts(), arena);
+    before.assign(numBlocks, empty);
+    after.assign(numBlocks, empty);
+    gen.assign(numBlocks, empty);
+    kill.assign(numBlocks, empty);
+
+    for (typename GraphT::block_iterator b = graph.block_begin(),
+           e = graph.block_end(); b != e; ++b) {
+      unsigned n = graph.getNumber(&*b);
+      problem.getBlockGenKill(&*b, gen[n], kill[n]);
+      if (ProblemT::meet == MEET_INTERSECTION)
+        getOut(n).setAll();
+    }
+
+    BlockWorklist<GraphT> worklist(graph, ProblemT::direction, arena);
+    while (!worklist.empty()) {
+      BlockT *bb = worklist.pop();
+      unsigned n = graph.getNumber(bb);
+      if (ProblemT::direction == FORWARD) {
+        meet(getIn(n), GraphT::pred_begin(bb), GraphT::pred_end(bb));
+        if (getOut(n).assignTransfer(getIn(n), kill[n], gen[n]))
+          for (typename GraphT::succ_iterator s = GraphT::succ_begin(bb),
+                 e = GraphT::succ_end(bb); s != e; ++s)
+            worklist.push(*s);
+      } else {
+        meet(getIn(n), GraphT::succ_begin(bb), GraphT::succ_end(bb));
+        if (getOut(n).assignTransfer(getIn(n), kill[n], gen[n]))
+          for (typename GraphT::pred_iterator p = GraphT::pred_begin(bb),
+                 e = GraphT::pred_end(bb); p != e; ++p)
+            worklist.push(*p);
+      }
+    }
+    numPops = worklist.getNumPops();
+    numPasses = worklist.getNumPasses();
+  }
+
+  //**********************************************************************
+  // refineBlock
+  //
+  // walk bb's instructions in the problem's direction, calling
+  // V(inst, before, after) with the sets just before and just after each
+  // instruction
+  //**********************************************************************
+  template<class VisitorT>
+  void refineBlock(BlockT *bb, VisitorT &V) {
+    unsigned n = graph.getNumber(bb);
+    BitSet S(getIn(n));
+    BitSet old(S);
+    typename GraphT::instr_iterator I, B = GraphT::instr_begin(bb),
+      E = GraphT::instr_end(bb);
+    if (ProblemT::direction == FORWARD) {
+      for (I = B; I != E; ++I) {
+        old = S;
+        problem.transfer(&*I, S);
+        V(&*I, old, S);
+      }
+    } else {
+      for (I = E; I != B; ) {
+        --I;
+        old = S;
+        problem.transfer(&*I, S);
+        V(&*I, S, old);
+      }
+    }
+  }
+
+  // the sets at the top and bottom of a block, in program order
+  const BitSet &getBefore(BlockT *bb) const { return before[graph.getNumber(bb)]; }
+  const BitSet &getAfter(BlockT *bb) const { return after[graph.getNumber(bb)]; }
+
+  // all block sets, by block number
+  vector<BitSet> &getBeforeSets() { return before; }
+  vector<BitSet> &getAfterSets() { return after; }
+  vector<BitSet> &getGenSets() { return gen; }
+  vector<BitSet> &getKillSets() { return kill; }
+
+  // worklist statistics of the last solve
+  unsigned getNumPops() const { return numPops; }
+  unsigned getNumPasses() const { return numPasses; }
+
+private:
+  GraphT &graph;
+  ProblemT &problem;
+  Arena &arena;
+  vector<BitSet> before, after, gen, kill;  // by block number
+  unsigned numPops, numPasses;
+
+  // the set the meet computes, and the set the transfer computes
+  BitSet &getIn(unsigned n) { return ProblemT::direction == FORWARD ? before[n] : after[n]; }
+  BitSet &getOut(unsigned n) { return ProblemT::direction == FORWARD ? after[n] : before[n]; }
+
+  // result = meet of the out sets of the blocks in [I, E), or the empty
+  // set if there are none
+  template<class IteratorT>
+  void meet(BitSet &result, IteratorT I, IteratorT E) {
+    if (I == E) {
+      result.clear();
+      return;
+    }
+    result = getOut(graph.getNumber(*I));
+    for (++I; I != E; ++I) {
+      if (ProblemT::meet == MEET_UNION)
+        result.unionWith(getOut(graph.getNumber(*I)));
+      else
+        result.intersectWith(getOut(graph.getNumber(*I)));
+    }
+  }
+};
+
+//**********************************************************************
+// InstrSetCache
+//
+// Answers "what is the set just before / after instruction I" from the
+// block boundary sets of a solved problem, without storing a set per
+// instruction: the first query in a block walks the whole block from its
+// boundary set with the problem's transfer function and keeps the sets
+// at every point of the block in one of a few slots; the least recently
+// used slot is refilled when a query hits a block that is not cached.
+// Memory is O(slots x longest block x facts) instead of
+// O(instructions x facts), plus one position per instruction seen.
+//
+// inSets are the sets the transfer starts from, by block number: the
+// before sets for a forward problem, the after sets for a backward one.
+// They must outlive the cache, and a block whose instructions or in set
+// change must be invalidated before it is queried again.
+//**********************************************************************
+template<class GraphT, class ProblemT>
+class InstrSetCache {
+public:
+  typedef typename GraphT::BlockT BlockT;
+  typedef typename GraphT::InstrT InstrT;
+
+  InstrSetCache(GraphT G, ProblemT &P, const vector<BitSet> &in, Arena &A,
+                unsigned numSlots = 4)
+    : graph(G), problem(P), inSets(in), arena(A), slots(numSlots),
+      clock(0), numQueries(0), numFills(0) {}
+
+  const BitSet &getBefore(InstrT *I) {
+    Slot &S = lookup(GraphT::getParent(I));
+    return S.sets[position.lookup(I)];
+  }
+
+  const BitSet &getAfter(InstrT *I) {
+    Slot &S = lookup(GraphT::getParent(I));
+    return S.sets[position.lookup(I) + 1];
+  }
+
+  // forget the sets of bb, if cached
+  void invalidate(BlockT *bb) {
+    for (unsigned i = 0; i < slots.size(); i++)
+      if (slots[i].bb == bb) {
+        slots[i].bb = 0;
+        slots[i].lastUse = 0;
+      }
+  }
+
+  // forget the sets of every block
+  void invalidateAll() {
+    for (unsigned i = 0; i < slots.size(); i++) {
+      slots[i].bb = 0;
+      slots[i].lastUse = 0;
+    }
+    position.clear();
+  }
+
+  // queries answered, and how many of them had to walk a block
+  unsigned getNumQueries() const { return numQueries; }
+  unsigned getNumFills() const { return numFills; }
+
+private:
+  struct Slot {
+    Slot() : bb(0), lastUse(0) {}
+    BlockT *bb;
+    unsigned lastUse;
+    vector<BitSet> sets;  // sets[k] is before the k-th instruction of bb
+  };
+
+  GraphT graph;
+  ProblemT &problem;
+  const vector<BitSet> &inSets;
+  Arena &arena;
+  vector<Slot> slots;
+  unsigned clock;
+  unsigned numQueries, numFills;
+  DenseMap<const InstrT *, unsigned> position;  // index within its block
+
+  Slot &lookup(BlockT *bb) {
+    numQueries++;
+    Slot *victim = &slots[0];
+    for (unsigned i = 0; i < slots.size(); i++) {
+      if (slots[i].bb == bb) {
+        slots[i].lastUse = ++clock;
+        return slots[i];
+      }
+      if (slots[i].lastUse < victim->lastUse)
+        victim = &slots[i];
+    }
+    fill(*victim, bb);
+    victim->lastUse = ++clock;
+    return *victim;
+  }
+
+  // compute the sets at every point of bb into S; slot sets are reused,
+  // so the arena only grows when a longer block than before is cached
+  void fill(Slot &S, BlockT *bb) {
+    numFills++;
+    vector<InstrT *> instrs;
+    for (typename GraphT::instr_iterator I = GraphT::instr_begin(bb),
+           E = GraphT::instr_end(bb); I != E; ++I) {
+      position[&*I] = instrs.size();
+      instrs.push_back(&*I);
+    }
+    // the problem may have more facts than the in sets were solved
+    // over (facts numbered since, which are in no in set)
+    unsigned n = problem.getNumFacts();
+    const BitSet &in = inSets[graph.getNumber(bb)];
+    while (S.sets.size() < instrs.size() + 1)
+      S.sets.push_back(BitSet(n, arena));
+    for (unsigned k = 0; k <= instrs.size(); k++)
+      if (S.sets[k].size() != n)
+        S.sets[k] = BitSet(n, arena);
+    S.bb = bb;
+    BitSet &start = S.sets[ProblemT::direction == FORWARD ? 0 : instrs.size()];
+    if (in.size() == n) {
+      start = in;
+    } else {
+      start.clear();
+      for (int i = in.findFirst(); i != -1; i = in.findNext(i))
+        start.set(i);
+    }
+    if (ProblemT::direction == FORWARD) {
+      for (unsigned k = 0; k < instrs.size(); k++) {
+        S.sets[k + 1] = S.sets[k];
+        problem.transfer(instrs[k], S.sets[k + 1]);
+      }
+    } else {
+      for (unsigned k = instrs.size(); k > 0; k--) {
+        S.sets[k - 1] = S.sets[k];
+        problem.transfer(instrs[k - 1], S.sets[k - 1]);
+      }
+    }
+  }
+};
+
+#endif
@@ -16,173 +16,2325 @@
 #define DEBUG_TYPE "gcra"
 #include <map>
 #include "RDfact.h"
+#include "BitSet.h"
+#include "Arena.h"
+#include "DataFlow.h"
+#include "Trace.h"
+#include "SlotColoring.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/System/TimeValue.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/BitVector.h"
 #include <stack>
 #include <queue>
+#include <limits>
+#include <algorithm>
 
 using namespace llvm;
 using namespace std;
 
-typedef map<const MachineBasicBlock *, set<unsigned>*> BBtoRegMap;
-typedef map<const MachineInstr *, set<unsigned>*> InstrToRegMap;
-typedef map<const MachineBasicBlock *, set<RDfact *>*> BBtoRDfactMap;
-typedef map<const MachineInstr *, set<RDfact *>*> InstrToRDfactMap;
+STATISTIC(NumVRegs,     "Number of virtual registers allocated");
+STATISTIC(NumEdges,     "Number of interference edges built");
+STATISTIC(NumSpills,    "Number of virtual registers spilled");
+STATISTIC(NumRemats,    "Number of spilled registers rematerialized");
+STATISTIC(NumLoopSplits, "Number of live ranges split around a loop");
+STATISTIC(NumCallSplits, "Number of live ranges split around calls");
+STATISTIC(NumPatchedRounds, "Number of rounds that reused the patched graph");
+STATISTIC(NumCoalesced, "Number of copies coalesced");
+STATISTIC(NumWebs,      "Number of vregs created by splitting webs");
+STATISTIC(NumDFVisits,  "Number of dataflow block visits");
+STATISTIC(NumColoredFns, "Number of functions allocated by graph coloring");
+STATISTIC(NumLinearScanFns, "Number of functions allocated by linear scan");
+STATISTIC(NumRegionFns, "Number of functions colored region by region");
+STATISTIC(NumRegionMoves, "Number of copies, stores and loads on region boundaries");
+STATISTIC(NumIPRACalls, "Number of calls given their callee's clobber set");
+STATISTIC(NumIPRARegs,  "Number of call clobbers the callee never writes");
 
-typedef map<const unsigned, set<MachineInstr *>*> RegToInstrsMap;
-typedef map<const unsigned, set<unsigned>*> RegToRegsMap;
+// functions past any of these limits are allocated by linear scan
+static cl::opt<unsigned> LINEAR_SCAN_INSTRS("gcra-linear-scan-instrs",
+  cl::init(50000), cl::desc("Allocate functions with more instructions "
+                            "than this by linear scan"));
+static cl::opt<unsigned> LINEAR_SCAN_VREGS("gcra-linear-scan-vregs",
+  cl::init(20000), cl::desc("Allocate functions with more virtual "
+                            "registers than this by linear scan"));
+static cl::opt<unsigned> REGION_BLOCKS("gcra-region-blocks", cl::init(1000),
+  cl::desc("Color functions with more blocks than this one region of at "
+           "most this many blocks at a time (0 = never)"));
+static cl::opt<bool> SPLIT("gcra-split", cl::init(true),
+  cl::desc("Split a live range that got no register around a loop or "
+           "around calls, when that costs less than spilling it"));
+static cl::opt<bool> IPRA("gcra-ipra", cl::init(false),
+  cl::desc("Let values live across a call to a function of this module "
+           "that was allocated earlier keep the registers it never writes"));
+static cl::opt<unsigned> TIME_BUDGET("gcra-time-budget", cl::init(5000),
+  cl::value_desc("ms"), cl::desc("Switch a function to linear scan once "
+                                 "allocating it took this many ms (0 = never)"));
 
+// debugging output, all off by default (llc -regalloc=gc -gcra-print-inst ...)
+// LLVM can output instructions after each stage:  -print-machineinstrs
+static cl::opt<bool> PRINT_INST("gcra-print-inst", cl::Hidden,
+  cl::desc("Print the instructions at the start of each Gcra round"));
+static cl::opt<bool> DEBUG_LIVE("gcra-debug-live", cl::Hidden,
+  cl::desc("Print the live sets of every block and instruction"));
+static cl::opt<bool> DEBUG_RD("gcra-debug-rd", cl::Hidden,
+  cl::desc("Print the reaching-defs sets of every block and instruction"));
+static cl::opt<bool> DEBUG_RANGE("gcra-debug-range", cl::Hidden,
+  cl::desc("Print the live ranges"));
+static cl::opt<bool> DEBUG_GRAPH("gcra-debug-graph", cl::Hidden,
+  cl::desc("Print the interference graph"));
+static cl::opt<bool> DEBUG_COLOR("gcra-debug-color", cl::Hidden,
+  cl::desc("Print the register given to each vreg"));
+static cl::opt<bool> DEBUG_SPILL("gcra-debug-spill", cl::Hidden,
+  cl::desc("Print the spill code inserted"));
+static cl::opt<bool> DEBUG_COALESCE("gcra-debug-coalesce", cl::Hidden,
+  cl::desc("Print the copies coalesced in each function"));
+static cl::opt<bool> DEBUG_SOLVE("gcra-debug-solve", cl::Hidden,
+  cl::desc("Print the work done by each dataflow solve"));
+
+// live sets are BitSets over dense register indexes (see RegNumbering),
+// reaching-defs sets are BitSets over RDfact IDs (see RDfactTable);
+// block sets are indexed by block number (instruction sets are not
+// stored, see InstrSetCache)
+typedef vector<BitSet> BBtoRegMap;
+typedef vector<BitSet> BBtoRDfactMap;
+
+// the block sets, the live intervals and the graph's adjacency lists
+// allocate from the Gcra's Arena, which is reset every round; the
+// RDfactTable and InstrToNumMap are cleared every round but use the heap
+class LiveInterval;
+typedef map<const unsigned, LiveInterval *, less<const unsigned>,
+            ArenaAllocator<pair<const unsigned, LiveInterval *> > > RegToIntervalMap;
+
+//**********************************************************************
+// RegNumbering
+//
+// Maps the registers (physical and virtual) that occur in a function to
+// a dense index space 0..size()-1, so that sets of registers can be
+// stored as BitSets.  Built once per function by Gcra::doInit.
+//**********************************************************************
+class RegNumbering {
+public:
+  static const unsigned NO_INDEX = ~0U;
+
+  void init(const TargetRegisterInfo *tri, const MachineRegisterInfo &MRI) {
+    numPhysRegs = tri->getNumRegs();
+    unsigned numVirtRegs =
+      MRI.getLastVirtReg() + 1 - TargetRegisterInfo::FirstVirtualRegister;
+    regToIdx.assign(numPhysRegs + numVirtRegs, NO_INDEX);
+    idxToReg.clear();
+  }
+
+  // return reg's index, giving it the next free one if it has none yet;
+  // vregs created since init (spill temps) are numbered too
+  unsigned addReg(unsigned reg) {
+    if (key(reg) >= regToIdx.size())
+      regToIdx.resize(key(reg) + 1, NO_INDEX);
+    unsigned &idx = regToIdx[key(reg)];
+    if (idx == NO_INDEX) {
+      idx = idxToReg.size();
+      idxToReg.push_back(reg);
+    }
+    return idx;
+  }
+
+  // return reg's index, or NO_INDEX if reg does not occur in the function
+  unsigned getIdx(unsigned reg) const {
+    return key(reg) < regToIdx.size() ? regToIdx[key(reg)] : NO_INDEX;
+  }
+
+  // forget every reg added since init, in time proportional to their
+  // number rather than to the number of registers
+  void reset() {
+    for (unsigned i = 0; i < idxToReg.size(); i++)
+      regToIdx[key(idxToReg[i])] = NO_INDEX;
+    idxToReg.clear();
+  }
+
+  unsigned getReg(unsigned idx) const { return idxToReg[idx]; }
+
+  unsigned size() const { return idxToReg.size(); }
+
+private:
+  unsigned numPhysRegs;
+  vector<unsigned> regToIdx;
+  vector<unsigned> idxToReg;
+
+  unsigned key(unsigned reg) const {
+    if (TargetRegisterInfo::isPhysicalRegister(reg))
+      return reg;
+    return numPhysRegs + reg - TargetRegisterInfo::FirstVirtualRegister;
+  }
+};
+
+//**********************************************************************
+// SlotIndex
+//
+// Instructions are numbered linearly (InstrToNumMap, 1..N in layout
+// order); instruction n has two slots: 2n where it reads its uses and
+// 2n+1 where it writes its defs.  A use and a def of the same
+// instruction therefore do not overlap.
+//**********************************************************************
+struct SlotIndex {
+  static unsigned getUse(unsigned num) { return 2 * num; }
+  static unsigned getDef(unsigned num) { return 2 * num + 1; }
+  // the slot just past the end of the block whose last instruction is num
+  static unsigned getBlockEnd(unsigned num) { return 2 * num + 2; }
+  static unsigned getInstrNum(unsigned slot) { return slot / 2; }
+};
+
+//**********************************************************************
+// LiveInterval
+//
+// The live range of one vreg: a sorted vector of disjoint, non-adjacent
+// half-open [start, end) segments of slot indexes.
+//**********************************************************************
+class LiveInterval {
+public:
+  struct Segment {
+    unsigned start, end;
+    bool operator<(const Segment &S) const { return start < S.start; }
+  };
+  typedef vector<Segment, ArenaAllocator<Segment> > SegmentVector;
+  typedef SegmentVector::const_iterator iterator;
+
+  explicit LiveInterval(Arena &A) : segs(ArenaAllocator<Segment>(A)) {}
+
+  // add [start, end); call normalize() when done adding
+  void addSegment(unsigned start, unsigned end) {
+    Segment S;
+    S.start = start;
+    S.end = end;
+    segs.push_back(S);
+  }
+
+  // sort the segments and merge the ones that overlap or touch
+  void normalize() {
+    sort(segs.begin(), segs.end());
+    unsigned out = 0;
+    for (unsigned i = 1; i < segs.size(); i++) {
+      if (segs[i].start <= segs[out].end) {
+        if (segs[i].end > segs[out].end)
+          segs[out].end = segs[i].end;
+      } else {
+        segs[++out] = segs[i];
+      }
+    }
+    if (!segs.empty())
+      segs.resize(out + 1);
+  }
+
+  // return true iff some slot is in both intervals
+  bool overlaps(const LiveInterval &other) const {
+    iterator i = begin(), ie = end(), j = other.begin(), je = other.end();
+    while (i != ie && j != je) {
+      if (i->end <= j->start)
+        ++i;
+      else if (j->end <= i->start)
+        ++j;
+      else
+        return true;
+    }
+    return false;
+  }
+
+  // return true iff slot is in the interval
+  bool liveAt(unsigned slot) const {
+    Segment S;
+    S.start = slot;
+    S.end = slot;
+    iterator i = upper_bound(begin(), end(), S);
+    if (i == begin())
+      return false;
+    --i;
+    return slot < i->end;
+  }
+
+  iterator begin() const { return segs.begin(); }
+  iterator end() const { return segs.end(); }
+  bool empty() const { return segs.empty(); }
+
+  // the first slot and the slot past the last one (must not be empty)
+  unsigned getStart() const { return segs.front().start; }
+  unsigned getEnd() const { return segs.back().end; }
+
+private:
+  SegmentVector segs;
+};
+
+//**********************************************************************
+// AliasMatrix
+//
+// The alias relation of a target's physical registers, as a bit matrix
+// (row r holds r and every alias of r) plus the alias lists themselves.
+// It depends only on the target, so it is built once per
+// TargetRegisterInfo and shared by every function compiled for it.
+//**********************************************************************
+class AliasMatrix {
+public:
+  static const AliasMatrix &get(const TargetRegisterInfo *TRI) {
+    static map<const TargetRegisterInfo *, AliasMatrix *> cache;
+    AliasMatrix *&M = cache[TRI];
+    if (!M)
+      M = new AliasMatrix(TRI);
+    return *M;
+  }
+
+  // the aliases of physical register reg, not including reg
+  const vector<unsigned> &getAliases(unsigned reg) const { return aliases[reg]; }
+
+  // do physical registers a and b share any bits
+  bool overlaps(unsigned a, unsigned b) const { return rows[a].test(b); }
+
+private:
+  Arena arena;
+  vector<BitSet> rows;
+  vector<vector<unsigned> > aliases;
+
+  AliasMatrix(const TargetRegisterInfo *TRI) {
+    unsigned n = TRI->getNumRegs();
+    rows.assign(n, BitSet(n, arena));
+    aliases.resize(n);
+    for (unsigned r = 1; r < n; r++) {
+      rows[r].set(r);
+      for (const unsigned *a = TRI->getAliasSet(r); a && *a; a++) {
+        rows[r].set(*a);
+        aliases[r].push_back(*a);
+      }
+    }
+  }
+};
+
+//**********************************************************************
+// ClobberRegistry
+//
+// The physical registers each function allocated so far may change, as
+// seen by its callers (for -gcra-ipra).  A function's set holds every
+// register it defines, implicit defs of its calls included, and their
+// aliases.  The set is recorded before prologue/epilogue insertion, so
+// it also holds every reserved register (the stack and frame pointers
+// the frame code adjusts) and every callee-saved register (which that
+// code may save, restore, or use as scratch); only the caller-saved
+// registers the callee provably leaves alone are missing.  The sets are
+// kept for one module, keyed by the IR function, and dropped when Gcra
+// starts on the next one (Gcra::doInitialization).
+//
+// A set is applied when a caller's operands are decoded (see
+// OperandSummary::add); the call instruction itself keeps the target's
+// implicit defs, so later passes see it unchanged.
+//
+// llc allocates functions in module order, not bottom-up over the call
+// graph, so a call only benefits when its callee was compiled first.
+// Calls to a function not yet allocated -- in particular every call
+// that closes a recursive cycle, seen from the first function of the
+// cycle compiled -- keep the target's conservative implicit defs, and
+// since those end up in the caller's own set, the sets stay sound
+// around recursion.
+//**********************************************************************
+class ClobberRegistry {
+public:
+  static ClobberRegistry &get() {
+    static ClobberRegistry registry;
+    return registry;
+  }
+
+  // the registers F may clobber, or 0 if F has not been recorded
+  const BitSet *lookup(const Function *F) const {
+    map<const Function *, BitSet>::const_iterator i = sets.find(F);
+    return i == sets.end() ? 0 : &i->second;
+  }
+
+  // the registers call MI may clobber, or 0 if MI is not a direct call
+  // to a recorded function that cannot be replaced at link time
+  const BitSet *getCallClobbers(const MachineInstr *MI) const {
+    if (!MI->getDesc().isCall())
+      return 0;
+    const Function *callee = 0;
+    for (unsigned i = 0, e = MI->getNumOperands(); i != e && !callee; i++)
+      if (MI->getOperand(i).isGlobal())
+        callee = dyn_cast<Function>(MI->getOperand(i).getGlobal());
+    if (!callee || callee->mayBeOverridden())
+      return 0;
+    return lookup(callee);
+  }
+
+  // record the registers allocated function Fn may clobber
+  void record(MachineFunction &Fn, const TargetRegisterInfo *TRI,
+              const AliasMatrix &aliasMatrix) {
+    BitSet clobbers(TRI->getNumRegs(), arena);
+    for (MachineFunction::iterator bb = Fn.begin(), bbe = Fn.end();
+         bb != bbe; ++bb)
+      for (MachineBasicBlock::iterator I = bb->begin(), E = bb->end();
+           I != E; ++I) {
+        const BitSet *callee = getCallClobbers(I);
+        for (unsigned i = 0, e = I->getNumOperands(); i != e; ++i) {
+          const MachineOperand &MOp = I->getOperand(i);
+          if (!MOp.isReg() || !MOp.isDef() || !MOp.getReg() ||
+              !TargetRegisterInfo::isPhysicalRegister(MOp.getReg()))
+            continue;
+          // a call only clobbers what its callee does
+          if (callee && MOp.isImplicit() && !callee->test(MOp.getReg()))
+            continue;
+          addReg(clobbers, MOp.getReg(), aliasMatrix);
+        }
+      }
+
+    BitVector reserved = TRI->getReservedRegs(Fn);
+    for (int r = reserved.find_first(); r != -1; r = reserved.find_next(r))
+      addReg(clobbers, r, aliasMatrix);
+    for (const unsigned *csr = TRI->getCalleeSavedRegs(&Fn); csr && *csr;
+         ++csr)
+      addReg(clobbers, *csr, aliasMatrix);
+    sets[Fn.getFunction()] = clobbers;
+  }
+
+  // forget every function
+  void clear() {
+    sets.clear();
+    arena.reset();
+  }
+
+private:
+  Arena arena;
+  map<const Function *, BitSet> sets;
+
+  static void addReg(BitSet &clobbers, unsigned reg, const AliasMatrix &am) {
+    clobbers.set(reg);
+    const vector<unsigned> &A = am.getAliases(reg);
+    for (unsigned a = 0; a < A.size(); a++)
+      clobbers.set(A[a]);
+  }
+};
+
+//**********************************************************************
+// OperandSummary
+//
+// The register operands of every instruction of a function, decoded
+// once per round.  Record r holds the dense indexes (see RegNumbering)
+// of the regs instruction r uses and of the regs it defines; each list
+// already includes the aliases of physical registers and has no
+// duplicates.  The lists of all records are packed into one flat array:
+// starts[2r] is where r's uses begin, starts[2r+1] where its defs
+// begin, and starts[2r+2] where they end.  The RDfact ID of each def
+// entry is kept in a parallel array, so the reaching-defs transfer
+// function needs no table lookups.
+//**********************************************************************
+class OperandSummary {
+public:
+  typedef const unsigned *iterator;
+
+  OperandSummary() : stamp(0) { clear(); }
+
+  void clear() {
+    ids.clear();
+    facts.clear();
+    starts.assign(1, 0);
+    instrs.clear();
+    index.clear();
+    seen.clear();
+    stamp = 0;
+  }
+
+  //**********************************************************************
+  // add
+  //
+  // append the record of MI, giving every reg it mentions (and every
+  // alias of a physical reg) a dense index if it has none yet; a
+  // record MI already had is dropped.  If MI is a call and clobbers is
+  // not 0, it holds what the callee may clobber (see ClobberRegistry),
+  // and the implicit defs of any other register are left out.
+  //**********************************************************************
+  void add(MachineInstr *MI, RegNumbering &regNums, const AliasMatrix &am,
+           const BitSet *clobbers = 0) {
+    remove(MI);
+    index[MI] = instrs.size();
+    instrs.push_back(MI);
+    addOperands(MI, false, regNums, am, 0);
+    addOperands(MI, true, regNums, am, clobbers);
+  }
+
+  // intern the RDfact of every def entry; call after the last add(),
+  // when the reg numbering is complete
+  void internDefs(RDfactTable &RDfacts, const RegNumbering &regNums) {
+    facts.assign(ids.size(), 0);
+    for (unsigned r = 0; r < instrs.size(); r++)
+      for (unsigned i = starts[2 * r + 1]; i < starts[2 * r + 2]; i++)
+        facts[i] = RDfacts.intern(regNums.getReg(ids[i]), ids[i], instrs[r]);
+  }
+
+  // forget the record of MI, if any, before MI is erased or decoded
+  // again; its lists stay in the flat arrays until clear()
+  void remove(const MachineInstr *MI) {
+    DenseMap<const MachineInstr *, unsigned>::iterator I = index.find(MI);
+    if (I == index.end())
+      return;
+    instrs[I->second] = 0;
+    index.erase(I);
+  }
+
+  // the record of MI, which must have been added
+  unsigned getRecord(const MachineInstr *MI) const {
+    DenseMap<const MachineInstr *, unsigned>::const_iterator I = index.find(MI);
+    assert(I != index.end() && "instruction has no operand record");
+    return I->second;
+  }
+
+  iterator use_begin(unsigned r) const { return base() + starts[2 * r]; }
+  iterator use_end(unsigned r) const { return base() + starts[2 * r + 1]; }
+  iterator def_begin(unsigned r) const { return base() + starts[2 * r + 1]; }
+  iterator def_end(unsigned r) const { return base() + starts[2 * r + 2]; }
+
+  // the RDfact ID of def entry d
+  unsigned getDefFact(iterator d) const { return facts[d - base()]; }
+
+private:
+  vector<unsigned> ids;           // dense reg indexes of all records
+  vector<unsigned> facts;         // parallel to ids, for def entries
+  vector<unsigned> starts;
+  vector<MachineInstr *> instrs;  // by record
+  DenseMap<const MachineInstr *, unsigned> index;
+  vector<unsigned> seen;          // by dense index: last list it went into
+  unsigned stamp;
+
+  const unsigned *base() const { return ids.empty() ? 0 : &ids[0]; }
+
+  // append the regs of MI's use (or def) operands as one list
+  void addOperands(MachineInstr *MI, bool defs, RegNumbering &regNums,
+                   const AliasMatrix &am, const BitSet *clobbers) {
+    stamp++;
+    for (unsigned i = 0, e = MI->getNumOperands(); i != e; i++) {
+      MachineOperand &op = MI->getOperand(i);
+      if (!op.isReg() || !op.getReg() || (defs ? !op.isDef() : !op.isUse()))
+        continue;
+      if (clobbers && op.isImplicit() &&
+          TargetRegisterInfo::isPhysicalRegister(op.getReg()) &&
+          !clobbers->test(op.getReg()))
+        continue;
+      addReg(op.getReg(), regNums);
+      if (TargetRegisterInfo::isPhysicalRegister(op.getReg())) {
+        const vector<unsigned> &aliases = am.getAliases(op.getReg());
+        for (unsigned k = 0; k < aliases.size(); k++)
+          addReg(aliases[k], regNums);
+      }
+    }
+    starts.push_back(ids.size());
+  }
+
+  void addReg(unsigned reg, RegNumbering &regNums) {
+    unsigned idx = regNums.addReg(reg);
+    if (idx >= seen.size())
+      seen.resize(idx + 1, 0);
+    if (seen[idx] != stamp) {
+      seen[idx] = stamp;
+      ids.push_back(idx);
+    }
+  }
+};
+
+//**********************************************************************
+// RegClassInfo
+//
+// Per-function facts about the register classes: the allocation order
+// of each class (its colors), and for each pair of classes A, B the
+// most registers of A that one register of B can block, i.e. overlap
+// through aliases or sub-registers.  One GR32 register blocks two GR8
+// registers (EAX blocks AL and AH), one GR8 register blocks one GR32
+// register, and a GR32 register blocks no FR32 register, so vregs of
+// classes that can never share a register never interfere.  It also
+// gives, for a physical register, which colors of a class it blocks.
+//**********************************************************************
+class RegClassInfo {
+public:
+  RegClassInfo(const MachineFunction &Fn, const TargetRegisterInfo *tri,
+               const AliasMatrix &am)
+    : MF(Fn), TRI(tri), aliasMatrix(am), numClasses(tri->getNumRegClasses())
+  {
+    orders.resize(numClasses);
+    ordered.assign(numClasses, false);
+    worst.assign(numClasses * numClasses, -1);
+  }
+
+  const vector<unsigned> &getOrder(const TargetRegisterClass *RC) {
+    unsigned id = RC->getID();
+    if (!ordered[id]) {
+      for (TargetRegisterClass::iterator r = RC->allocation_order_begin(MF),
+             e = RC->allocation_order_end(MF); r != e; ++r)
+        orders[id].push_back(*r);
+      // the colors of a class are bits of one BitSet::Word (see
+      // getBlockedMask and Coloring::select); no class of the targets
+      // we build for has more registers than that
+      assert(orders[id].size() <= BitSet::BITS_PER_WORD &&
+             "register class has more colors than a mask word holds");
+      ordered[id] = true;
+    }
+    return orders[id];
+  }
+
+  // K for vregs of class RC
+  unsigned getNumColors(const TargetRegisterClass *RC) {
+    return getOrder(RC).size();
+  }
+
+  // the most registers of class A that one register of class B blocks
+  unsigned getWorst(const TargetRegisterClass *A, const TargetRegisterClass *B) {
+    int &w = worst[A->getID() * numClasses + B->getID()];
+    if (w == -1) {
+      const vector<unsigned> &orderA = getOrder(A);
+      const vector<unsigned> &orderB = getOrder(B);
+      w = 0;
+      for (unsigned b = 0; b < orderB.size(); b++) {
+        int n = 0;
+        for (unsigned a = 0; a < orderA.size(); a++)
+          if (aliasMatrix.overlaps(orderA[a], orderB[b]))
+            n++;
+        if (n > w)
+          w = n;
+      }
+    }
+    return w;
+  }
+
+  // can a vreg of class A and one of class B ever get overlapping registers
+  bool overlaps(const TargetRegisterClass *A, const TargetRegisterClass *B) {
+    return getWorst(A, B) != 0;
+  }
+
+  // bit i set iff getOrder(RC)[i] overlaps physical register reg
+  BitSet::Word getBlockedMask(const TargetRegisterClass *RC, unsigned reg) {
+    const vector<unsigned> &order = getOrder(RC);
+    BitSet::Word mask = 0;
+    for (unsigned i = 0; i < order.size(); i++)
+      if (aliasMatrix.overlaps(order[i], reg))
+        mask |= BitSet::Word(1) << i;
+    return mask;
+  }
+
+private:
+  const MachineFunction &MF;
+  const TargetRegisterInfo *TRI;
+  const AliasMatrix &aliasMatrix;
+  unsigned numClasses;
+  vector<vector<unsigned> > orders;   // by class ID, filled lazily
+  vector<bool> ordered;
+  vector<int> worst;                  // [A * numClasses + B], -1 if not computed
+};
+
+//**********************************************************************
+// Graph
+//
+// The interference graph over the dense register indexes of a function
+// (see RegNumbering).  Vregs get edges to each other, when their classes
+// can overlap (see RegClassInfo), and to physical registers that overlap
+// some register of their class; the physical registers are precolored
+// nodes and get no edges among themselves.  Fixed-register operands and
+// the implicit defs of calls are ordinary physreg operands, so a vreg
+// live across a call interferes with every register the call clobbers.
+// Edges are kept twice: in a lower-triangular bit matrix for O(1)
+// interference queries, and in per-node adjacency vectors for iterating
+// over neighbors.
+//**********************************************************************
 class Graph {
 public:
-  RegToRegsMap graph;
+  typedef vector<unsigned, ArenaAllocator<unsigned> > AdjList;
+
+  // the matrix has n(n-1)/2 bits and BitSet indexes bits with an
+  // unsigned, so a graph may have at most this many nodes; functions
+  // with more regs are allocated by linear scan (Gcra::useLinearScan)
+  static const unsigned MAX_NODES = 92681;
 
 private:
-  void connect(unsigned reg1, unsigned reg2) 
+  Arena &arena;
+  RegNumbering &regNums;
+  RegClassInfo &classes;
+  const AliasMatrix &aliasMatrix;
+  MachineRegisterInfo *MRI;
+  BitSet matrix;
+  vector<AdjList> adj;
+  unsigned numEdges;
+  unsigned capacity;              // nodes the matrix has room for
+  vector<bool> removed;           // by node, see removeNode
+  BitSet live;                    // scratch for addBlock
+
+  // bit for the edge {a, b}, a != b, in the lower triangle
+  static unsigned edgeBit(unsigned a, unsigned b) {
+    if (a < b)
+      swap(a, b);
+    assert(a < MAX_NODES && "interference matrix index overflows");
+    return unsigned(uint64_t(a) * (a - 1) / 2 + b);
+  }
+
+  // bits in the matrix of a graph with room for n nodes
+  static unsigned matrixBits(unsigned n) {
+    assert(n <= MAX_NODES && "interference matrix too large");
+    return n ? unsigned(uint64_t(n) * (n - 1) / 2 + 1) : 1;
+  }
+
+  void connect(unsigned a, unsigned b) 
   {
-    set<unsigned> *s = graph[reg1];
-    if (!s) {
-      s = new set<unsigned>();
-      graph[reg1] = s;
+    unsigned bit = edgeBit(a, b);
+    if (matrix.test(bit))
+      return;
+    matrix.set(bit);
+    adj[a].push_back(b);
+    adj[b].push_back(a);
+    numEdges++;
+  }
+
+  // a def of x interferes with a live y unless y is (part of) the
+  // register x is copied from
+  bool isCopyOf(unsigned y, unsigned copySrc) const {
+    if (y == copySrc)
+      return true;
+    return copySrc && TargetRegisterInfo::isPhysicalRegister(y) &&
+      TargetRegisterInfo::isPhysicalRegister(copySrc) &&
+      aliasMatrix.overlaps(y, copySrc);
+  }
+
+  // the node of the reg with dense index idx in fnNums, or NO_INDEX
+  unsigned getNode(const RegNumbering &fnNums, unsigned idx) const {
+    return &fnNums == &regNums ? idx : regNums.getIdx(fnNums.getReg(idx));
+  }
+
+  // a region's graph leaves out the vregs kept in memory there
+  bool isNode(const RegNumbering &fnNums, unsigned idx) const {
+    return getNode(fnNums, idx) != RegNumbering::NO_INDEX;
+  }
+
+  // connect x and y if they are distinct registers that could be given
+  // overlapping physical registers and at least one is virtual
+  void addEdges(unsigned x, unsigned y) {
+    bool xVirt = TargetRegisterInfo::isVirtualRegister(x);
+    bool yVirt = TargetRegisterInfo::isVirtualRegister(y);
+    if (x == y || (!xVirt && !yVirt))
+      return;
+    if (xVirt && yVirt) {
+      if (!classes.overlaps(MRI->getRegClass(x), MRI->getRegClass(y)))
+        return;
+    } else {
+      unsigned v = xVirt ? x : y, p = xVirt ? y : x;
+      if (!classes.getBlockedMask(MRI->getRegClass(v), p))
+        return;
+    }
+    connect(regNums.getIdx(x), regNums.getIdx(y));
+  }
+
+  void init() {
+    unsigned n = regNums.size();
+    capacity = n;
+    matrix = BitSet(matrixBits(n), arena);
+    adj.assign(n, AdjList(ArenaAllocator<unsigned>(arena)));
+    removed.assign(n, false);
+    live = BitSet(n, arena);
+  }
+
+  // Chaitin's construction for block b: walk it backwards from its
+  // live-out set; every vreg defined by an instruction interferes with
+  // every vreg live after it, except that the source of a copy does not
+  // interfere with its destination (so the copy can later be coalesced).
+  // liveOut and the operand records are over fnNums.
+  void addBlock(MachineBasicBlock *b, const BitSet &liveOut,
+                const RegNumbering &fnNums, const OperandSummary &ops,
+                const TargetInstrInfo *TII) {
+    if (&fnNums == &regNums) {
+      live = liveOut;
+    } else {
+      live.clear();
+      for (int i = liveOut.findFirst(); i != -1; i = liveOut.findNext(i))
+        if (isNode(fnNums, i))
+          live.set(getNode(fnNums, i));
+    }
+    MachineBasicBlock::iterator N = b->end();
+    while (N != b->begin()) {
+      --N;
+      unsigned copySrc = 0;
+      unsigned src, dst, srcSub, dstSub;
+      if (TII->isMoveInstr(*N, src, dst, srcSub, dstSub))
+        copySrc = src;
+
+      unsigned r = ops.getRecord(N);
+      OperandSummary::iterator d, de = ops.def_end(r), u, ue = ops.use_end(r);
+      // defs interfere with everything live after N
+      for (d = ops.def_begin(r); d != de; ++d)
+        if (isNode(fnNums, *d))
+          for (int l = live.findFirst(); l != -1; l = live.findNext(l))
+            if (!isCopyOf(regNums.getReg(l), copySrc))
+              addEdges(fnNums.getReg(*d), regNums.getReg(l));
+      // live before N = (live after N - defs) union uses, with aliases
+      for (d = ops.def_begin(r); d != de; ++d)
+        if (isNode(fnNums, *d))
+          live.reset(getNode(fnNums, *d));
+      for (u = ops.use_begin(r); u != ue; ++u)
+        if (isNode(fnNums, *u))
+          live.set(getNode(fnNums, *u));
+    } // end iterating instructions backwards
+  }
+
+public:    
+  // the graph of the whole function; its nodes are rn's dense indexes
+  Graph(MachineFunction &Fn, BBtoRegMap &liveAfterMap, RegNumbering &rn,
+        const OperandSummary &ops, RegClassInfo &rci, const AliasMatrix &am,
+        const TargetInstrInfo *TII, Arena &A)
+    : arena(A), regNums(rn), classes(rci), aliasMatrix(am),
+      MRI(&Fn.getRegInfo()), numEdges(0)
+  {
+    init();
+    for (MachineFunction::iterator b = Fn.begin(), e = Fn.end(); b != e; ++b)
+      addBlock(b, liveAfterMap[b->getNumber()], rn, ops, TII);
+  }
+
+  // the graph of some of the blocks of the function (see
+  // RegionAllocator); its nodes are nodeNums' dense indexes.  nodeNums
+  // holds the regs live in or mentioned by the blocks, less any vreg
+  // the caller keeps out of registers there; such a vreg must not be
+  // mentioned by the blocks
+  Graph(MachineFunction &Fn, const vector<MachineBasicBlock *> &blocks,
+        BBtoRegMap &liveAfterMap, const RegNumbering &fnNums,
+        RegNumbering &nodeNums, const OperandSummary &ops,
+        RegClassInfo &rci, const AliasMatrix &am,
+        const TargetInstrInfo *TII, Arena &A)
+    : arena(A), regNums(nodeNums), classes(rci), aliasMatrix(am),
+      MRI(&Fn.getRegInfo()), numEdges(0)
+  {
+    init();
+    for (unsigned i = 0; i < blocks.size(); i++)
+      addBlock(blocks[i], liveAfterMap[blocks[i]->getNumber()], fnNums, ops,
+               TII);
+  }
+
+  // make the regs of liveIn (over fnNums) interfere with each other.
+  // For a region's graph: regs live into the region from outside are
+  // all live at once at its entry, though the region may hold no def
+  // of any of them for the construction to see that at.
+  void addClique(const BitSet &liveIn, const RegNumbering &fnNums) {
+    vector<unsigned> regs;
+    for (int i = liveIn.findFirst(); i != -1; i = liveIn.findNext(i))
+      if (isNode(fnNums, i))
+        regs.push_back(fnNums.getReg(i));
+    for (unsigned a = 1; a < regs.size(); a++)
+      for (unsigned b = 0; b < a; b++)
+        addEdges(regs[a], regs[b]);
+  }
+
+  // a and b are dense reg indexes
+  bool interferes(unsigned a, unsigned b) const {
+    return a != b && matrix.test(edgeBit(a, b));
+  }
+
+  const AdjList &getNeighbors(unsigned a) const { return adj[a]; }
+
+  unsigned getDegree(unsigned a) const { return adj[a].size(); }
+
+  unsigned getNumNodes() const { return adj.size(); }
+
+  unsigned getNumEdges() const { return numEdges; }
+
+  // The graph of the whole function is patched in place after spilling
+  // (see Gcra::spillAndUpdate) rather than rebuilt.  Nodes are only
+  // ever added at the end of the numbering, and the rows of the lower
+  // triangle are stored in node order, so growing the matrix keeps
+  // every existing bit where it is.
+
+  // make room for the regs numbered since the graph was built
+  void grow() {
+    unsigned n = regNums.size();
+    if (n > capacity) {
+      capacity = min(max(n, capacity + capacity / 2), unsigned(MAX_NODES));
+      matrix.grow(matrixBits(capacity));
+    }
+    adj.resize(n, AdjList(ArenaAllocator<unsigned>(arena)));
+    removed.resize(n, false);
+  }
+
+  // drop node a (a spilled vreg) and all of its edges
+  void removeNode(unsigned a) {
+    for (unsigned j = 0; j < adj[a].size(); j++) {
+      unsigned b = adj[a][j];
+      adj[b].erase(find(adj[b].begin(), adj[b].end(), a));
+      matrix.reset(edgeBit(a, b));
+      numEdges--;
+    }
+    adj[a].clear();
+    removed[a] = true;
+  }
+
+  // is a still a node of the graph
+  bool hasNode(unsigned a) const { return !removed[a]; }
+
+  // connect regs x and y as the construction does
+  void addInterference(unsigned x, unsigned y) { addEdges(x, y); }
+
+  // give keep all of gone's edges (used when coalescing gone into keep);
+  // gone's own adjacency list is left as it was
+  void merge(unsigned keep, unsigned gone) {
+    for (unsigned j = 0; j < adj[gone].size(); j++)
+      if (adj[gone][j] != keep)
+        connect(keep, adj[gone][j]);
+  }
+
+  void debug()
+  {
+    errs() << "\n\nINTERFERENCE GRAPH\n";
+    for (unsigned a = 0; a < adj.size(); a++) {
+      if (adj[a].empty())
+        continue;
+      errs() << regNums.getReg(a) << ": {";
+      for (AdjList::const_iterator i = adj[a].begin(), e = adj[a].end(); i != e; ++i)
+        errs() << " " << regNums.getReg(*i);
+      errs() << " }\n";
+    }
+  }
+};
+
+class LiveRange {
+public:
+  RegToIntervalMap range;
+
+  // Physical registers don't obey the single assignment rule, but the
+  // backward walk below never assumed it: every def just closes the
+  // segment that is open.  A def or use of a physical register counts
+  // for its aliases too, as it does in the live analysis.
+  LiveRange(MachineFunction &Fn, BBtoRegMap &liveAfterMap,
+            map<MachineInstr *, unsigned> &InstrToNumMap, RegNumbering &rn,
+            const OperandSummary &ops, Arena &A)
+    : range(less<const unsigned>(), ArenaAllocator<unsigned>(A)),
+      regNums(rn), arena(A)
+  {
+    // 1. Build initial live ranges
+    // For each CFG node D that defines variable x, the initial live range for D consists of: 
+    // ( <x>, <{D} union {N | x in N.live-before and D in N.reaching-defs-before}> ) 
+    // x in N.live-before means that x is used in N or after,
+    // D in N.reaching-defs-before means that the use of x in N really is defined by D
+    // PHI elimination leaves vregs with several defs, so Gcra::splitWebs
+    // first renames each web (defs that reach a common use) to its own
+    // vreg; after that, all the defs of a vreg belong together.
+
+    // 2. Convert initial live ranges to final live ranges (collapse overlapping initial live ranges for the same variable):
+    // LLVM IR has true SSA due to phi nodes, but phi nodes have been eliminated in the lowered representation.
+    // So it's possible that x is defined twice in two branches.
+
+    // We combine the two steps into one, and represent the set of
+    // points where x is live as an interval of slot indexes: walk each
+    // block backwards from its live-out set, opening a segment at the
+    // last use (or at the block end, if x is live out) and closing it
+    // at the def (or at the block start, if x is live in).
+    vector<unsigned> openEnd(regNums.size());
+    BitSet open(regNums.size(), arena);
+    for (MachineFunction::iterator b = Fn.begin(), e = Fn.end(); b != e; ++b) {
+      if (b->empty())
+        continue;
+      vector<MachineInstr *> instVector;
+      for (MachineBasicBlock::iterator N = b->begin(), e = b->end(); N != e; ++N)
+        instVector.push_back(N);
+      unsigned firstNum = InstrToNumMap[instVector.front()];
+      unsigned num = firstNum + instVector.size() - 1;
+
+      // every reg live out of the block is live up to its end
+      open = liveAfterMap[b->getNumber()];
+      for (int idx = open.findFirst(); idx != -1; idx = open.findNext(idx))
+        openEnd[idx] = SlotIndex::getBlockEnd(num);
+
+      for (; !instVector.empty(); instVector.pop_back(), --num) {
+        unsigned r = ops.getRecord(instVector.back());
+        // defs end the segment that is open (or make a dead one)
+        for (OperandSummary::iterator d = ops.def_begin(r), de = ops.def_end(r);
+             d != de; ++d)
+          closeSegment(*d, num, open, openEnd);
+        // uses open a segment ending just before this instruction's defs
+        for (OperandSummary::iterator u = ops.use_begin(r), ue = ops.use_end(r);
+             u != ue; ++u)
+          openSegment(*u, num, open, openEnd);
+      } // end iterating instructions backwards
+
+      // whatever is still open is live into the block
+      for (int idx = open.findFirst(); idx != -1; idx = open.findNext(idx))
+        getInterval(regNums.getReg(idx))->addSegment(SlotIndex::getUse(firstNum),
+                                                     openEnd[idx]);
+    } // end iterating blocks
+
+    for (RegToIntervalMap::iterator p = range.begin(), e = range.end(); p != e; ++p)
+      p->second->normalize();
+  }
+
+  void debug()
+  {
+    errs() << "\n\nLIVE RANGES (slot 2n = uses of %n, 2n+1 = defs of %n)\n";
+    RegToIntervalMap::iterator p, e;
+    for (p = range.begin(), e = range.end(); p != e; ++p) {
+      errs() << p->first << ": {";
+      LiveInterval *LI = p->second;
+      for (LiveInterval::iterator i = LI->begin(), e = LI->end(); i != e; ++i)
+        errs() << " [" << i->start << ", " << i->end << ")";
+      errs() << " }\n";
+    }
+  }
+
+private:
+  RegNumbering &regNums;
+  Arena &arena;
+
+  LiveInterval *getInterval(unsigned reg) {
+    LiveInterval *&LI = range[reg];
+    if (!LI)
+      LI = new (arena) LiveInterval(arena);
+    return LI;
+  }
+
+  // a def of the reg with dense index idx by instruction num ends the
+  // segment that is open (or makes a dead one)
+  void closeSegment(unsigned idx, unsigned num, BitSet &open,
+                    vector<unsigned> &openEnd) {
+    unsigned end = open.test(idx) ? openEnd[idx] : SlotIndex::getDef(num) + 1;
+    getInterval(regNums.getReg(idx))->addSegment(SlotIndex::getDef(num), end);
+    open.reset(idx);
+  }
+
+  // a use of the reg with dense index idx by instruction num opens a
+  // segment unless one is open
+  void openSegment(unsigned idx, unsigned num, BitSet &open,
+                   vector<unsigned> &openEnd) {
+    if (!open.test(idx)) {
+      open.set(idx);
+      openEnd[idx] = SlotIndex::getDef(num);
+    }
+  }
+};
+
+//**********************************************************************
+// Coalescer
+//
+// Conservative copy coalescing over a Graph.  A copy between two vregs
+// of the same class that do not interfere is removed by merging the
+// source and destination into one node, but only when the merged node
+// is sure to stay colorable:
+//   Briggs: it has fewer than K neighbors of degree >= K, or
+//   George: every neighbor of the source already interferes with the
+//           destination or has degree < K.
+// Copies are tried hottest first (by the loop depth of their block), so
+// that when two copies compete for a merge the one in the inner loop
+// wins.  Merged vregs are tracked in a union-find over dense indexes;
+// apply() renames each vreg to its representative and deletes the
+// coalesced copies, after which the analyses must be rerun.
+//**********************************************************************
+class Coalescer {
+public:
+  Coalescer(MachineFunction &Fn, Graph &G, RegNumbering &rn,
+            RegClassInfo &rci, const TargetInstrInfo *tii, MachineLoopInfo *LI,
+            const set<unsigned> &noCoalesce, Arena &A)
+    : MF(Fn), graph(G), regNums(rn), classes(rci), TII(tii), loopInfo(LI),
+      unmergeable(noCoalesce), na(rn.size(), A), nb(rn.size(), A)
+  {
+    leader.resize(regNums.size());
+    for (unsigned i = 0; i < leader.size(); i++)
+      leader[i] = i;
+  }
+
+  //**********************************************************************
+  // run
+  //
+  // decide which copies to coalesce; return how many
+  //**********************************************************************
+  unsigned run() {
+    vector<Copy> copies;
+    findCopies(copies);
+    stable_sort(copies.begin(), copies.end());
+    for (unsigned i = 0; i < copies.size(); i++) {
+      unsigned a = find(copies[i].src), b = find(copies[i].dst);
+      if (a != b && (graph.interferes(a, b) || !canMerge(a, b)))
+        continue;
+      if (a != b) {
+        // keep the destination's name
+        leader[a] = b;
+        graph.merge(b, a);
+      }
+      coalesced.push_back(copies[i].MI);
+    }
+    return coalesced.size();
+  }
+
+  //**********************************************************************
+  // apply
+  //
+  // rename every merged vreg to its representative and delete the
+  // coalesced copies (which are now copies of a register to itself)
+  //**********************************************************************
+  void apply() {
+    MachineRegisterInfo &MRI = MF.getRegInfo();
+    for (unsigned i = 0; i < leader.size(); i++)
+      if (find(i) != i)
+        MRI.replaceRegWith(regNums.getReg(i), regNums.getReg(find(i)));
+    for (unsigned i = 0; i < coalesced.size(); i++)
+      coalesced[i]->eraseFromParent();
+  }
+
+private:
+  struct Copy {
+    MachineInstr *MI;
+    unsigned src, dst;            // dense indexes
+    float weight;
+    // hottest first
+    bool operator<(const Copy &C) const { return weight > C.weight; }
+  };
+
+  MachineFunction &MF;
+  Graph &graph;
+  RegNumbering &regNums;
+  RegClassInfo &classes;
+  const TargetInstrInfo *TII;
+  MachineLoopInfo *loopInfo;
+  const set<unsigned> &unmergeable;
+
+  vector<unsigned> leader;        // union-find parent, by dense index
+  vector<MachineInstr *> coalesced;
+  BitSet na, nb;                  // scratch neighbor sets for canMerge
+
+  unsigned find(unsigned i) {
+    while (leader[i] != i) {
+      leader[i] = leader[leader[i]];
+      i = leader[i];
+    }
+    return i;
+  }
+
+  // collect the full-register copies between coalescable vregs
+  void findCopies(vector<Copy> &copies) {
+    const MachineRegisterInfo &MRI = MF.getRegInfo();
+    for (MachineFunction::iterator b = MF.begin(), e = MF.end(); b != e; ++b) {
+      float weight = 1;
+      for (unsigned d = loopInfo->getLoopDepth(b); d > 0; d--)
+        weight *= 10;
+      for (MachineBasicBlock::iterator N = b->begin(), ne = b->end(); N != ne; ++N) {
+        unsigned src, dst, srcSub, dstSub;
+        if (!TII->isMoveInstr(*N, src, dst, srcSub, dstSub) || srcSub || dstSub ||
+            !TargetRegisterInfo::isVirtualRegister(src) ||
+            !TargetRegisterInfo::isVirtualRegister(dst) ||
+            MRI.getRegClass(src) != MRI.getRegClass(dst) ||
+            unmergeable.count(src) || unmergeable.count(dst))
+          continue;
+        Copy C;
+        C.MI = N;
+        C.src = regNums.getIdx(src);
+        C.dst = regNums.getIdx(dst);
+        C.weight = weight;
+        copies.push_back(C);
+      }
+    }
+  }
+
+  // the current neighbors of representative a (after earlier merges)
+  void getNeighbors(unsigned a, BitSet &result) {
+    result.clear();
+    const Graph::AdjList &adj = graph.getNeighbors(a);
+    for (unsigned j = 0; j < adj.size(); j++)
+      if (find(adj[j]) != a)
+        result.set(find(adj[j]));
+  }
+
+  // Briggs' or George's test for merging representative a into b
+  // a and b have the same class; neighbors t may not, so "t has
+  // significant degree" means t's weighted degree is >= t's own K, and
+  // t takes up to getWorst(class, class of t) of the merged node's colors
+  bool canMerge(unsigned a, unsigned b) {
+    const TargetRegisterClass *RC = getClass(b);
+    unsigned K = classes.getNumColors(RC);
+    getNeighbors(a, na);
+    getNeighbors(b, nb);
+
+    // George
+    bool george = true;
+    for (int t = na.findFirst(); t != -1 && george; t = na.findNext(t))
+      if (!nb.test(t) && isSignificant(t))
+        george = false;
+    if (george)
+      return true;
+
+    // Briggs
+    na.unionWith(nb);
+    unsigned blocked = 0;
+    BitSet::Word precolored = 0;
+    for (int t = na.findFirst(); t != -1; t = na.findNext(t)) {
+      unsigned reg = regNums.getReg(t);
+      if (TargetRegisterInfo::isPhysicalRegister(reg))
+        precolored |= classes.getBlockedMask(RC, reg);
+      else if (isSignificant(t))
+        blocked += classes.getWorst(RC, getClass(t));
+    }
+    return blocked + __builtin_popcountll(precolored) < K;
+  }
+
+  const TargetRegisterClass *getClass(unsigned idx) {
+    return MF.getRegInfo().getRegClass(regNums.getReg(idx));
+  }
+
+  // is t's weighted degree >= its K?  (adjacency lists may still hold
+  // edges to merged-away nodes, so this can overestimate, which only
+  // makes the tests more conservative)
+  // A precolored (physical) t can never be simplified, so it always is.
+  bool isSignificant(unsigned t) {
+    unsigned treg = regNums.getReg(t);
+    if (TargetRegisterInfo::isPhysicalRegister(treg))
+      return true;
+    const TargetRegisterClass *RC = getClass(t);
+    unsigned K = classes.getNumColors(RC);
+    unsigned weighted = 0;
+    BitSet::Word precolored = 0;
+    const Graph::AdjList &adj = graph.getNeighbors(t);
+    for (unsigned j = 0; j < adj.size(); j++) {
+      unsigned reg = regNums.getReg(adj[j]);
+      if (TargetRegisterInfo::isPhysicalRegister(reg))
+        precolored |= classes.getBlockedMask(RC, reg);
+      else
+        weighted += classes.getWorst(RC, getClass(adj[j]));
+    }
+    return weighted + __builtin_popcountll(precolored) >= K;
+  }
+};
+
+//**********************************************************************
+// ColorHints
+//
+// A preference from outside a Coloring (see RegionAllocator): the
+// register a vreg should take if it is free, so that a vreg colored in
+// several graphs keeps one register where it can.  Indexes are those of
+// the Coloring's RegNumbering.
+//**********************************************************************
+class ColorHints {
+public:
+  virtual ~ColorHints() {}
+
+  // the register vreg idx would best be given, or 0 for none
+  virtual unsigned getHint(unsigned idx) = 0;
+};
+
+//**********************************************************************
+// Coloring
+//
+// Optimistic (Briggs) simplify/select coloring of the vreg nodes of a
+// Graph.  The colors of a vreg are the physical registers in its class's
+// allocation order.  Neighbors of another class may take more than one
+// of them (a GR32 neighbor blocks both AL and AH of a GR8 vreg), so each
+// neighbor counts as the most colors its class can block (see
+// RegClassInfo::getWorst), and a vreg of a class with K registers is
+// trivially colorable while this weighted degree is below K.
+//
+// Simplify keeps the nodes still in the graph in doubly-linked buckets
+// keyed by degree - K (offset so keys are non-negative); any node in a
+// bucket below the offset has degree < K, so taking a trivially
+// colorable node, and every degree decrement, is O(1).  When no node is
+// trivially colorable the one with the lowest spill cost / degree is
+// pushed anyway (optimistically).  Those candidates come from a min-heap
+// that is revalidated lazily: an entry records the degree its key was
+// computed for, and one popped after the degree dropped is pushed back
+// with its new (larger) key.  Degrees only drop, so the first current
+// entry popped is the true minimum, and each optimistic push costs
+// O(log n) amortized over the degree decrements.
+// Select pops the stack and gives each node the first register whose
+// bit is clear in a forbidden-color mask built from its colored
+// neighbors; nodes that find no register are left uncolored (spilled).
+// A ColorHints, if given, picks among the free registers; otherwise
+// the first in allocation order is taken.
+//**********************************************************************
+class Coloring {
+public:
+  Coloring(MachineFunction &Fn, Graph &G, RegNumbering &rn,
+           RegClassInfo &rci, const vector<float> &cost,
+           ColorHints *h = 0)
+    : MF(Fn), graph(G), regNums(rn), classes(rci), spillCost(cost),
+      hints(h)
+  {
+    unsigned n = regNums.size();
+    color.assign(n, 0);
+    inGraph.assign(n, false);
+    degree.assign(n, 0);
+    numColors.assign(n, 0);
+    bucketOf.assign(n, -1);
+    next.assign(n, -1);
+    prev.assign(n, -1);
+    maxColors = 0;
+
+    MachineRegisterInfo &MRI = Fn.getRegInfo();
+    for (unsigned idx = 0; idx < n; idx++) {
+      unsigned reg = regNums.getReg(idx);
+      if (!graph.hasNode(idx))
+        continue;
+      // physical registers are precolored and never simplified
+      if (!TargetRegisterInfo::isVirtualRegister(reg)) {
+        color[idx] = reg;
+        continue;
+      }
+      numColors[idx] = classes.getNumColors(MRI.getRegClass(reg));
+      if (numColors[idx] > maxColors)
+        maxColors = numColors[idx];
+      nodes.push_back(idx);
+    }
+  }
+
+  //**********************************************************************
+  // run
+  //
+  // color the graph; return true iff every vreg got a register
+  //**********************************************************************
+  bool run() {
+    simplify();
+    return select();
+  }
+
+  // the physical register given to the vreg with dense index idx, or 0
+  unsigned getColor(unsigned idx) const { return color[idx]; }
+
+  // the physical register of every reg by dense index, 0 if none
+  const vector<unsigned> &getColors() const { return color; }
+
+  // dense indexes of the vregs that got no register
+  const vector<unsigned> &getSpilled() const { return spilled; }
+
+  unsigned getNumVRegs() const { return nodes.size(); }
+
+  void debug() {
+    errs() << "\n\nCOLORING\n";
+    for (unsigned i = 0; i < nodes.size(); i++) {
+      unsigned idx = nodes[i];
+      errs() << regNums.getReg(idx) << ": ";
+      if (color[idx])
+        errs() << MF.getTarget().getRegisterInfo()->getName(color[idx]) << "\n";
+      else
+        errs() << "SPILLED\n";
+    }
+  }
+
+private:
+  MachineFunction &MF;
+  Graph &graph;
+  RegNumbering &regNums;
+  RegClassInfo &classes;
+  const vector<float> &spillCost; // by dense index, see computeSpillCosts
+  ColorHints *hints;              // 0 if none
+
+  vector<unsigned> nodes;         // dense indexes of all vregs
+  vector<unsigned> color;         // phys reg per node, 0 if none
+  vector<unsigned> stack;         // simplify order
+  vector<unsigned> spilled;
+
+  // simplify worklists
+  vector<bool> inGraph;
+  vector<unsigned> degree;        // weighted neighbors still in the graph
+  vector<unsigned> numColors;     // K of the node's class
+  unsigned maxColors;             // largest K, the bucket key offset
+  vector<int> bucketHead;
+  vector<int> bucketOf, next, prev;
+
+  // optimistic-push candidates, cheapest spill cost / degree on top
+  struct SpillEntry {
+    float cost;
+    unsigned node, degree;        // degree the cost was computed for
+    SpillEntry(float c, unsigned n, unsigned d) : cost(c), node(n), degree(d) {}
+    bool operator>(const SpillEntry &E) const {
+      return cost != E.cost ? cost > E.cost : node > E.node;
+    }
+  };
+  priority_queue<SpillEntry, vector<SpillEntry>, greater<SpillEntry> >
+    candidates;
+
+  // how many colors of node a's class node b can block
+  unsigned getWeight(unsigned a, unsigned b) {
+    MachineRegisterInfo &MRI = MF.getRegInfo();
+    return classes.getWorst(MRI.getRegClass(regNums.getReg(a)),
+                            MRI.getRegClass(regNums.getReg(b)));
+  }
+
+  unsigned bucketKey(unsigned idx) const {
+    return degree[idx] + maxColors - numColors[idx];
+  }
+
+  void bucketInsert(unsigned idx) {
+    unsigned key = bucketKey(idx);
+    bucketOf[idx] = key;
+    prev[idx] = -1;
+    next[idx] = bucketHead[key];
+    if (next[idx] != -1)
+      prev[next[idx]] = idx;
+    bucketHead[key] = idx;
+  }
+
+  void bucketRemove(unsigned idx) {
+    if (prev[idx] != -1)
+      next[prev[idx]] = next[idx];
+    else
+      bucketHead[bucketOf[idx]] = next[idx];
+    if (next[idx] != -1)
+      prev[next[idx]] = prev[idx];
+    bucketOf[idx] = -1;
+  }
+
+  // return a node with degree < K, or -1 if there is none
+  int takeTriviallyColorable() {
+    for (unsigned key = 0; key < maxColors && key < bucketHead.size(); key++)
+      if (bucketHead[key] != -1)
+        return bucketHead[key];
+    return -1;
+  }
+
+  SpillEntry makeSpillEntry(unsigned n) const {
+    float cost = degree[n] ? spillCost[n] / degree[n] : spillCost[n];
+    return SpillEntry(cost, n, degree[n]);
+  }
+
+  // return the node to push optimistically (the likeliest to be
+  // spilled): of the nodes that are not trivially colorable, which are
+  // all the nodes left when this is called, the one with the lowest
+  // spill cost per neighbor still in the graph
+  int takeSpillCandidate() {
+    while (!candidates.empty()) {
+      SpillEntry E = candidates.top();
+      candidates.pop();
+      if (!inGraph[E.node])
+        continue;
+      if (E.degree != degree[E.node]) {
+        candidates.push(makeSpillEntry(E.node));
+        continue;
+      }
+      return E.node;
+    }
+    return -1;
+  }
+
+  //**********************************************************************
+  // simplify
+  //
+  // remove all nodes from the graph, pushing each on the stack
+  //**********************************************************************
+  void simplify() {
+    unsigned maxDegree = 0;
+    for (unsigned i = 0; i < nodes.size(); i++)
+      inGraph[nodes[i]] = true;
+    MachineRegisterInfo &MRI = MF.getRegInfo();
+    for (unsigned i = 0; i < nodes.size(); i++) {
+      unsigned idx = nodes[i];
+      const TargetRegisterClass *RC = MRI.getRegClass(regNums.getReg(idx));
+      // precolored neighbors stay in the graph for good; they count as
+      // the colors they block, counting colors blocked by aliases once
+      BitSet::Word precolored = 0;
+      const Graph::AdjList &adj = graph.getNeighbors(idx);
+      for (unsigned j = 0; j < adj.size(); j++) {
+        if (inGraph[adj[j]])
+          degree[idx] += getWeight(idx, adj[j]);
+        else if (color[adj[j]])
+          precolored |= classes.getBlockedMask(RC, color[adj[j]]);
+      }
+      degree[idx] += __builtin_popcountll(precolored);
+      if (degree[idx] > maxDegree)
+        maxDegree = degree[idx];
+    }
+    bucketHead.assign(maxDegree + maxColors + 1, -1);
+    for (unsigned i = 0; i < nodes.size(); i++) {
+      bucketInsert(nodes[i]);
+      candidates.push(makeSpillEntry(nodes[i]));
+    }
+
+    for (unsigned remaining = nodes.size(); remaining > 0; remaining--) {
+      int n = takeTriviallyColorable();
+      if (n == -1)
+        n = takeSpillCandidate();
+      bucketRemove(n);
+      inGraph[n] = false;
+      stack.push_back(n);
+      const Graph::AdjList &adj = graph.getNeighbors(n);
+      for (unsigned j = 0; j < adj.size(); j++) {
+        unsigned m = adj[j];
+        if (!inGraph[m])
+          continue;
+        bucketRemove(m);
+        degree[m] -= getWeight(m, n);
+        bucketInsert(m);
+      }
+    }
+  }
+
+  //**********************************************************************
+  // select
+  //
+  // pop the stack, giving each node a color none of its neighbors has;
+  // return true iff every node got one
+  //**********************************************************************
+  bool select() {
+    MachineRegisterInfo &MRI = MF.getRegInfo();
+    while (!stack.empty()) {
+      unsigned n = stack.back();
+      stack.pop_back();
+      const vector<unsigned> &order =
+        classes.getOrder(MRI.getRegClass(regNums.getReg(n)));
+
+      // bit i set iff order[i] overlaps the register of a colored
+      // (or precolored) neighbor
+      BitSet::Word forbidden = 0;
+      const TargetRegisterClass *RC = MRI.getRegClass(regNums.getReg(n));
+      const Graph::AdjList &adj = graph.getNeighbors(n);
+      for (unsigned j = 0; j < adj.size(); j++)
+        if (color[adj[j]])
+          forbidden |= classes.getBlockedMask(RC, color[adj[j]]);
+      BitSet::Word free = ~forbidden;
+      if (order.size() < BitSet::BITS_PER_WORD)
+        free &= (BitSet::Word(1) << order.size()) - 1;
+      if (free == 0) {
+        spilled.push_back(n);
+        continue;
+      }
+      color[n] = order[__builtin_ctzll(free)];
+      if (unsigned hint = hints ? hints->getHint(n) : 0)
+        for (unsigned i = 0; i < order.size(); i++)
+          if (order[i] == hint && (free & (BitSet::Word(1) << i)))
+            color[n] = hint;
+    }
+    return spilled.empty();
+  }
+};
+
+//**********************************************************************
+// LinearScan
+//
+// The fallback allocator for functions too big to color (see
+// Gcra::useLinearScan): Poletto and Sarkar's linear scan over the live
+// intervals of a LiveRange, with no interference graph.  Vregs are
+// visited in order of interval start; a vreg may take a register of its
+// class unless the interval of that register (which, as LiveRange
+// builds it, covers every use and def of its aliases too) or of an
+// active vreg given an overlapping register overlaps its own.  When
+// every register is taken, the cheapest of the vreg and the active
+// vregs blocking some register is spilled, as Coloring's callers do.
+// Intervals keep their holes, so a vreg whose interval merely spans
+// another's lifetime hole does not conflict with it.
+//**********************************************************************
+class LinearScan {
+public:
+  LinearScan(MachineFunction &Fn, LiveRange &lr, RegNumbering &rn,
+             RegClassInfo &rci, const AliasMatrix &am,
+             const vector<float> &cost)
+    : MF(Fn), liveRange(lr), regNums(rn), classes(rci), aliasMatrix(am),
+      spillCost(cost)
+  {
+    color.assign(regNums.size(), 0);
+    for (unsigned idx = 0; idx < regNums.size(); idx++) {
+      unsigned reg = regNums.getReg(idx);
+      if (!TargetRegisterInfo::isVirtualRegister(reg)) {
+        color[idx] = reg;
+        continue;
+      }
+      nodes.push_back(idx);
+    }
+  }
+
+  //**********************************************************************
+  // run
+  //
+  // assign registers; return true iff every vreg got one
+  //**********************************************************************
+  bool run() {
+    vector<pair<unsigned, unsigned> > order;   // (start slot, idx)
+    for (unsigned i = 0; i < nodes.size(); i++)
+      order.push_back(make_pair(getInterval(nodes[i])->getStart(), nodes[i]));
+    sort(order.begin(), order.end());
+
+    vector<unsigned> active;
+    for (unsigned i = 0; i < order.size(); i++) {
+      unsigned cur = order[i].second;
+      expire(active, order[i].first);
+      if (assign(cur, active))
+        active.push_back(cur);
+    }
+    return spilled.empty();
+  }
+
+  unsigned getColor(unsigned idx) const { return color[idx]; }
+
+  // the physical register of every reg by dense index, 0 if none
+  const vector<unsigned> &getColors() const { return color; }
+
+  // dense indexes of the vregs that got no register
+  const vector<unsigned> &getSpilled() const { return spilled; }
+
+  unsigned getNumVRegs() const { return nodes.size(); }
+
+  void debug() {
+    errs() << "\n\nLINEAR SCAN\n";
+    for (unsigned i = 0; i < nodes.size(); i++) {
+      unsigned idx = nodes[i];
+      errs() << regNums.getReg(idx) << ": ";
+      if (color[idx])
+        errs() << MF.getTarget().getRegisterInfo()->getName(color[idx]) << "\n";
+      else
+        errs() << "SPILLED\n";
+    }
+  }
+
+private:
+  MachineFunction &MF;
+  LiveRange &liveRange;
+  RegNumbering &regNums;
+  RegClassInfo &classes;
+  const AliasMatrix &aliasMatrix;
+  const vector<float> &spillCost; // by dense index, see computeSpillCosts
+
+  vector<unsigned> nodes;         // dense indexes of all vregs
+  vector<unsigned> color;         // phys reg per node, 0 if none
+  vector<unsigned> spilled;
+
+  LiveInterval *getInterval(unsigned idx) {
+    RegToIntervalMap::const_iterator I =
+      liveRange.range.find(regNums.getReg(idx));
+    assert(I != liveRange.range.end() && "vreg has no live interval");
+    return I->second;
+  }
+
+  // drop the active vregs whose intervals end at or before slot
+  void expire(vector<unsigned> &active, unsigned slot) {
+    unsigned out = 0;
+    for (unsigned i = 0; i < active.size(); i++)
+      if (getInterval(active[i])->getEnd() > slot)
+        active[out++] = active[i];
+    active.resize(out);
+  }
+
+  //**********************************************************************
+  // assign
+  //
+  // give vreg cur a register, evicting cheaper active vregs if every
+  // register is taken; return true iff cur got a register (otherwise
+  // it is spilled)
+  //**********************************************************************
+  bool assign(unsigned cur, vector<unsigned> &active) {
+    const TargetRegisterClass *RC =
+      MF.getRegInfo().getRegClass(regNums.getReg(cur));
+    const vector<unsigned> &order = classes.getOrder(RC);
+    LiveInterval *LI = getInterval(cur);
+
+    // the register whose blocking active vregs cost least to spill
+    int best = -1;
+    float bestCost = 0;
+    vector<unsigned> blockers;
+    for (unsigned r = 0; r < order.size(); r++) {
+      unsigned phys = order[r];
+      RegToIntervalMap::iterator fixed = liveRange.range.find(phys);
+      if (fixed != liveRange.range.end() && fixed->second->overlaps(*LI))
+        continue;
+      bool blocked = false;
+      float cost = 0;
+      for (unsigned i = 0; i < active.size(); i++)
+        if (aliasMatrix.overlaps(phys, color[active[i]]) &&
+            getInterval(active[i])->overlaps(*LI)) {
+          blocked = true;
+          cost += spillCost[active[i]];
+        }
+      if (!blocked) {
+        color[cur] = phys;
+        return true;
+      }
+      if (best == -1 || cost < bestCost) {
+        best = r;
+        bestCost = cost;
+      }
+    }
+
+    if (best == -1 || bestCost >= spillCost[cur]) {
+      spilled.push_back(cur);
+      return false;
+    }
+    unsigned phys = order[best];
+    unsigned out = 0;
+    for (unsigned i = 0; i < active.size(); i++) {
+      unsigned a = active[i];
+      if (aliasMatrix.overlaps(phys, color[a]) &&
+          getInterval(a)->overlaps(*LI)) {
+        color[a] = 0;
+        spilled.push_back(a);
+      } else {
+        active[out++] = a;
+      }
+    }
+    active.resize(out);
+    color[cur] = phys;
+    return true;
+  }
+};
+
+//**********************************************************************
+// getLoopWeight
+//
+// return the weight of one use or def in a block at the given loop
+// depth: each level of loop nesting counts as 10 iterations
+//**********************************************************************
+static float getLoopWeight(unsigned depth) {
+  float weight = 1;
+  for (unsigned i = 0; i < depth && i < 20; i++)
+    weight *= 10;
+  return weight;
+}
+
+//**********************************************************************
+// RegionSpills
+//
+// The vregs a RegionAllocator keeps in memory in some of its regions,
+// over all the rounds of one function: (region, vreg) pairs, a region
+// named by the number of its first block, and the one stack slot of
+// each such vreg.  The regions are the same in every round, as spill
+// code adds no blocks.
+//**********************************************************************
+struct RegionSpills {
+  set<pair<unsigned, unsigned> > inMemory;
+  map<unsigned, int> slots;       // vreg -> its stack slot
+
+  bool isInMemory(unsigned region, unsigned reg) const {
+    return inMemory.count(make_pair(region, reg)) != 0;
+  }
+
+  void clear() {
+    inMemory.clear();
+    slots.clear();
+  }
+};
+
+//**********************************************************************
+// RegionAllocator
+//
+// Coloring for functions with more blocks than one graph should cover
+// (see REGION_BLOCKS).  The blocks are partitioned into regions: the
+// blocks of each loop that are in none of its inner loops, and the
+// blocks in no loop, each cut into pieces of at most REGION_BLOCKS
+// blocks in layout order.  Each region is colored on its own, with a
+// Graph over just the regs live in or mentioned by its blocks, so no
+// graph is larger than its region; the regs live into a region from
+// outside get a clique at each of its entry blocks.
+//
+// A vreg live in several regions gets an assignment in each: a
+// register, or its stack slot if that region spilled it (spill code
+// goes into the blocks of that region only, see RegionSpills).
+// Regions are colored deepest loops first, and a vreg prefers the
+// register it got in the last region colored (see ColorHints), so its
+// assignments tend to differ only on the edges into and out of loops.
+// Once every region is colored, placeBoundaryCode reconciles them on
+// each edge between two regions: for every vreg live across the edge
+// that the regions keep in different places, it stores the ones that
+// go to memory, copies the ones that change registers (in an order
+// where no copy overwrites a register another still reads, a cycle
+// being broken through a stack slot), then loads the ones that come
+// from memory.  The code goes at the top of the edge's target if it
+// has one predecessor, else at the end of the source if it has one
+// successor, else into a new block that splits the edge.  A function
+// with an edge that needs splitting but cannot be split (see canTile)
+// is allocated by linear scan instead.
+//**********************************************************************
+class RegionAllocator : public ColorHints {
+public:
+  RegionAllocator(MachineFunction &Fn, BBtoRegMap &liveBefore,
+                  BBtoRegMap &liveAfter, RegNumbering &rn,
+                  const OperandSummary &ops, RegClassInfo &rci,
+                  const AliasMatrix &am, MachineLoopInfo *li,
+                  const TargetInstrInfo *tii, const set<unsigned> &temps,
+                  RegionSpills &rs, unsigned maxBlocks)
+    : MF(Fn), liveBeforeMap(liveBefore), liveAfterMap(liveAfter),
+      regNums(rn), operands(ops), classes(rci), aliasMatrix(am),
+      loopInfo(li), TII(tii), spillTemps(temps), regionSpills(rs),
+      numVRegs(0), maxNodes(0), numEdges(0), numSplits(0)
+  {
+    for (unsigned idx = 0; idx < regNums.size(); idx++)
+      if (TargetRegisterInfo::isVirtualRegister(regNums.getReg(idx)))
+        numVRegs++;
+    hint.assign(regNums.size(), 0);
+    nodeNums.init(Fn.getTarget().getRegisterInfo(), Fn.getRegInfo());
+    buildRegions(Fn, loopInfo, maxBlocks, regions, regionOf);
+    colors.resize(regions.size());
+  }
+
+  //**********************************************************************
+  // canTile
+  //
+  // can every edge between two regions of Fn take boundary code: its
+  // target has one predecessor, its source has one successor and
+  // terminators that read no register, or the edge can be split
+  //**********************************************************************
+  static bool canTile(MachineFunction &Fn, MachineLoopInfo *loopInfo,
+                      const TargetInstrInfo *TII, unsigned maxBlocks) {
+    vector<Region> regions;
+    vector<unsigned> regionOf;
+    buildRegions(Fn, loopInfo, maxBlocks, regions, regionOf);
+    for (MachineFunction::iterator p = Fn.begin(), e = Fn.end(); p != e; ++p)
+      for (MachineBasicBlock::succ_iterator s = p->succ_begin(),
+             se = p->succ_end(); s != se; ++s)
+        if (regionOf[p->getNumber()] != regionOf[(*s)->getNumber()] &&
+            (*s)->pred_size() != 1 && !canPlaceAtEnd(p) &&
+            !canSplit(p, *s, TII))
+          return false;
+    return true;
+  }
+
+  //**********************************************************************
+  // run
+  //
+  // color every region; return true iff every vreg got a register in
+  // every region that does not keep it in memory
+  //**********************************************************************
+  bool run() {
+    for (unsigned r = 0; r < regions.size(); r++)
+      colorRegion(r);
+    return spilled.empty();
+  }
+
+  unsigned getNumRegions() const { return regions.size(); }
+
+  const vector<MachineBasicBlock *> &getBlocks(unsigned r) const {
+    return regions[r].blocks;
+  }
+
+  // the name of region r in RegionSpills
+  unsigned getKey(unsigned r) const {
+    return regions[r].blocks.front()->getNumber();
+  }
+
+  // set color[idx] for every vreg idx given a register in region r
+  void getColors(unsigned r, vector<unsigned> &color) const {
+    for (DenseMap<unsigned, unsigned>::const_iterator c = colors[r].begin(),
+           e = colors[r].end(); c != e; ++c)
+      color[c->first] = c->second;
+  }
+
+  // (region, dense index) of each vreg that got no register in a region
+  const vector<pair<unsigned, unsigned> > &getSpilled() const {
+    return spilled;
+  }
+
+  unsigned getNumVRegs() const { return numVRegs; }
+  unsigned getMaxNodes() const { return maxNodes; }
+  unsigned getNumEdges() const { return numEdges; }
+  unsigned getNumSplits() const { return numSplits; }
+
+  // ColorHints, over the nodes of the region being colored
+  unsigned getHint(unsigned node) { return hint[getIdx(node)]; }
+
+  //**********************************************************************
+  // placeBoundaryCode
+  //
+  // once the blocks are rewritten, move the vregs live across each edge
+  // between two regions from where the source's region keeps them to
+  // where the target's does; return the number of instructions inserted
+  //**********************************************************************
+  unsigned placeBoundaryCode() {
+    // splitting adds blocks and changes successors, so list the edges
+    // first
+    vector<pair<MachineBasicBlock *, MachineBasicBlock *> > edges;
+    for (MachineFunction::iterator p = MF.begin(), e = MF.end(); p != e; ++p)
+      for (MachineBasicBlock::succ_iterator s = p->succ_begin(),
+             se = p->succ_end(); s != se; ++s)
+        if (regionOf[p->getNumber()] != regionOf[(*s)->getNumber()])
+          edges.push_back(make_pair(&*p, *s));
+    unsigned n = 0;
+    for (unsigned i = 0; i < edges.size(); i++)
+      n += placeEdgeCode(edges[i].first, edges[i].second);
+    return n;
+  }
+
+  void debug() {
+    const TargetRegisterInfo *TRI = MF.getTarget().getRegisterInfo();
+    errs() << "\n\nREGIONS\n";
+    for (unsigned r = 0; r < regions.size(); r++) {
+      errs() << "region " << getKey(r) << ", depth " << regions[r].depth
+             << ":";
+      for (unsigned b = 0; b < regions[r].blocks.size(); b++)
+        errs() << " " << regions[r].blocks[b]->getNumber();
+      errs() << "\n";
+      for (DenseMap<unsigned, unsigned>::const_iterator c = colors[r].begin(),
+             e = colors[r].end(); c != e; ++c)
+        errs() << "  " << regNums.getReg(c->first) << ": "
+               << TRI->getName(c->second) << "\n";
+    }
+    errs() << "\n\nSPILLED\n";
+    for (unsigned i = 0; i < spilled.size(); i++)
+      errs() << regNums.getReg(spilled[i].second) << " in region "
+             << getKey(spilled[i].first) << "\n";
+  }
+
+private:
+  struct Region {
+    unsigned depth;                   // loop depth of its blocks
+    vector<MachineBasicBlock *> blocks;
+  };
+
+  struct DeeperFirst {
+    bool operator()(const Region &a, const Region &b) const {
+      return a.depth > b.depth;
+    }
+  };
+
+  // a vreg to move on an edge, from one register (or 0, slot) to another
+  struct Move {
+    unsigned reg, from, to;
+    int slot;
+  };
+
+  MachineFunction &MF;
+  BBtoRegMap &liveBeforeMap;
+  BBtoRegMap &liveAfterMap;
+  RegNumbering &regNums;
+  const OperandSummary &operands;
+  RegClassInfo &classes;
+  const AliasMatrix &aliasMatrix;
+  MachineLoopInfo *loopInfo;
+  const TargetInstrInfo *TII;
+  const set<unsigned> &spillTemps;
+  RegionSpills &regionSpills;
+  Arena regionArena;              // the current region's graph
+
+  vector<Region> regions;         // in coloring order
+  vector<unsigned> regionOf;      // by block number
+  RegNumbering nodeNums;          // the current region's regs
+  vector<DenseMap<unsigned, unsigned> > colors;  // by region: idx -> phys
+  vector<unsigned> hint;          // by dense index, 0 if none yet
+  vector<pair<unsigned, unsigned> > spilled;
+  unsigned numVRegs, maxNodes, numEdges, numSplits;
+
+  unsigned getIdx(unsigned node) const {
+    return regNums.getIdx(nodeNums.getReg(node));
+  }
+
+  // the register region r gives vreg idx, or 0 if it keeps it in memory
+  unsigned getLocation(unsigned r, unsigned idx) const {
+    DenseMap<unsigned, unsigned>::const_iterator c = colors[r].find(idx);
+    return c == colors[r].end() ? 0 : c->second;
+  }
+
+  int getSlot(unsigned reg) const {
+    map<unsigned, int>::const_iterator s = regionSpills.slots.find(reg);
+    assert(s != regionSpills.slots.end() && "vreg in memory has no slot");
+    return s->second;
+  }
+
+  //**********************************************************************
+  // buildRegions
+  //
+  // group the blocks of Fn by innermost loop, starting a new region of
+  // a loop whenever its current one has maxBlocks blocks, and order the
+  // regions deepest first (in layout order within a depth); regionOf
+  // maps each block number to its region
+  //**********************************************************************
+  static void buildRegions(MachineFunction &Fn, MachineLoopInfo *loopInfo,
+                           unsigned maxBlocks, vector<Region> &regions,
+                           vector<unsigned> &regionOf) {
+    map<MachineLoop *, unsigned> open;  // loop -> its region being filled
+    for (MachineFunction::iterator b = Fn.begin(), e = Fn.end(); b != e; ++b) {
+      MachineLoop *L = loopInfo->getLoopFor(b);
+      map<MachineLoop *, unsigned>::iterator r = open.find(L);
+      if (r == open.end() || regions[r->second].blocks.size() >= maxBlocks) {
+        regions.push_back(Region());
+        regions.back().depth = L ? L->getLoopDepth() : 0;
+        open[L] = regions.size() - 1;
+        r = open.find(L);
+      }
+      regions[r->second].blocks.push_back(b);
     }
-    s->insert(reg2);
+    stable_sort(regions.begin(), regions.end(), DeeperFirst());
+    regionOf.assign(Fn.getNumBlockIDs(), 0);
+    for (unsigned r = 0; r < regions.size(); r++)
+      for (unsigned b = 0; b < regions[r].blocks.size(); b++)
+        regionOf[regions[r].blocks[b]->getNumber()] = r;
   }
-  
-  bool set_intersect(set<MachineInstr *> *S1, set<MachineInstr *> *S2) {
-    for (set<MachineInstr *>::iterator i1 = S1->begin();
-         i1 != S1->end();
-         i1++) {
-      if (S2->count(*i1))
+
+  // can boundary code go just before p's terminators: p has one
+  // successor and its terminators read no register
+  static bool canPlaceAtEnd(MachineBasicBlock *p) {
+    if (p->succ_size() != 1)
+      return false;
+    for (MachineBasicBlock::iterator I = p->getFirstTerminator(),
+           E = p->end(); I != E; ++I)
+      for (unsigned i = 0, e = I->getNumOperands(); i != e; ++i) {
+        const MachineOperand &MOp = I->getOperand(i);
+        if (MOp.isReg() && MOp.getReg() && MOp.isUse())
+          return false;
+      }
+    return true;
+  }
+
+  // can edge p -> s be split: p's branch is understood (so that its
+  // target can be changed) and s is no landing pad
+  static bool canSplit(MachineBasicBlock *p, MachineBasicBlock *s,
+                       const TargetInstrInfo *TII) {
+    if (s->isLandingPad())
+      return false;
+    MachineBasicBlock *TBB = 0, *FBB = 0;
+    SmallVector<MachineOperand, 4> cond;
+    return !TII->AnalyzeBranch(*p, TBB, FBB, cond, false);
+  }
+
+  // is b entered from outside region r (or from nowhere)
+  bool isEntry(MachineBasicBlock *b, unsigned r) const {
+    if (b->pred_empty())
+      return true;
+    for (MachineBasicBlock::pred_iterator p = b->pred_begin(),
+           pe = b->pred_end(); p != pe; ++p)
+      if (regionOf[(*p)->getNumber()] != r)
         return true;
-    }
-      
     return false;
   }
 
-public:    
-  Graph(RegToInstrsMap &range)
-  {
-    map<const unsigned, set<MachineInstr *>*>::iterator p = range.begin(), q, e = range.end();
-    for (; p != e; ++p) {
-      unsigned reg1 = p->first;
-      set<MachineInstr *> *set1 = p->second;
-      q = p;
-      ++q;
-      for (; q != e; ++q) {
-        unsigned reg2 = q->first;
-        set<MachineInstr *> *set2 = q->second;
-        if (set_intersect(set1, set2)) {
-          connect(reg1, reg2);
-          connect(reg2, reg1);
-        }
+  // number the reg with dense index idx in the region named key, unless
+  // the region keeps it in memory, and add weight to its spill cost
+  void addNode(unsigned key, unsigned idx, float weight,
+               vector<float> &cost) {
+    unsigned reg = regNums.getReg(idx);
+    if (regionSpills.isInMemory(key, reg))
+      return;
+    unsigned node = nodeNums.addReg(reg);
+    if (node >= cost.size())
+      cost.resize(node + 1, 0);
+    cost[node] += weight;
+  }
+
+  //**********************************************************************
+  // colorRegion
+  //
+  // number the regs live in or mentioned by the blocks of region r (a
+  // reg live into a block is used in it or live out of it), with spill
+  // costs from their uses and defs in the region only (a vreg that is
+  // just live through costs nothing here but its boundary code); then
+  // build and color their graph
+  //**********************************************************************
+  void colorRegion(unsigned r) {
+    const vector<MachineBasicBlock *> &blocks = regions[r].blocks;
+    unsigned key = getKey(r);
+    vector<float> cost;
+    nodeNums.reset();
+    for (unsigned i = 0; i < blocks.size(); i++) {
+      const BitSet &live = liveAfterMap[blocks[i]->getNumber()];
+      for (int l = live.findFirst(); l != -1; l = live.findNext(l))
+        addNode(key, l, 0, cost);
+      float weight = getLoopWeight(loopInfo->getLoopDepth(blocks[i]));
+      for (MachineBasicBlock::iterator I = blocks[i]->begin(),
+             E = blocks[i]->end(); I != E; ++I) {
+        unsigned rec = operands.getRecord(I);
+        for (OperandSummary::iterator u = operands.use_begin(rec),
+               ue = operands.use_end(rec); u != ue; ++u)
+          addNode(key, *u, weight, cost);
+        for (OperandSummary::iterator d = operands.def_begin(rec),
+               de = operands.def_end(rec); d != de; ++d)
+          addNode(key, *d, weight, cost);
       }
     }
-  }
+    cost.resize(nodeNums.size(), 0);
+    for (unsigned node = 0; node < nodeNums.size(); node++)
+      if (spillTemps.count(nodeNums.getReg(node)))
+        cost[node] = numeric_limits<float>::infinity();
 
-  void debug()
-  {
-    errs() << "\n\nINTERFERENCE GRAPH\n";
-    map<const unsigned, set<unsigned>*>::iterator p, e;
-    for (p = graph.begin(), e = graph.end(); p != e; ++p) {
-      errs() << p->first << ": {";
-      set<unsigned> *s = p->second;
-      set<unsigned>::iterator i = s->begin(), e = s->end();
-      for(; i != e; ++i)
-        errs() << " " << *i;
-      errs() << " }\n";
+    regionArena.reset();
+    Graph graph(MF, blocks, liveAfterMap, regNums, nodeNums, operands,
+                classes, aliasMatrix, TII, regionArena);
+    for (unsigned i = 0; i < blocks.size(); i++)
+      if (isEntry(blocks[i], r))
+        graph.addClique(liveBeforeMap[blocks[i]->getNumber()], regNums);
+    if (graph.getNumNodes() > maxNodes)
+      maxNodes = graph.getNumNodes();
+    numEdges += graph.getNumEdges();
+
+    Coloring coloring(MF, graph, nodeNums, classes, cost, this);
+    coloring.run();
+    const vector<unsigned> &s = coloring.getSpilled();
+    for (unsigned i = 0; i < s.size(); i++)
+      spilled.push_back(make_pair(r, getIdx(s[i])));
+    for (unsigned node = 0; node < nodeNums.size(); node++) {
+      unsigned phys = coloring.getColor(node);
+      if (phys && TargetRegisterInfo::isVirtualRegister(nodeNums.getReg(node))) {
+        colors[r][getIdx(node)] = phys;
+        hint[getIdx(node)] = phys;
+      }
     }
   }
-};
 
-class LiveRange {
-public:
-  RegToInstrsMap range;
+  //**********************************************************************
+  // placeEdgeCode
+  //
+  // insert the boundary code of edge p -> s (see placeBoundaryCode);
+  // return the number of instructions inserted
+  //**********************************************************************
+  unsigned placeEdgeCode(MachineBasicBlock *p, MachineBasicBlock *s) {
+    unsigned rp = regionOf[p->getNumber()], rs = regionOf[s->getNumber()];
+    vector<Move> stores, copies, loads;
+    const BitSet &live = liveBeforeMap[s->getNumber()];
+    for (int l = live.findFirst(); l != -1; l = live.findNext(l)) {
+      Move M = { regNums.getReg(l), getLocation(rp, l), getLocation(rs, l),
+                 -1 };
+      if (!TargetRegisterInfo::isVirtualRegister(M.reg) || M.from == M.to)
+        continue;
+      if (M.from && M.to) {
+        copies.push_back(M);
+        continue;
+      }
+      M.slot = getSlot(M.reg);
+      if (M.from)
+        stores.push_back(M);
+      else
+        loads.push_back(M);
+    }
+    if (stores.empty() && copies.empty() && loads.empty())
+      return 0;
 
-  // TODO: Physical registers don't obey the single assignment rule, violating the assumptions we made below!
-  // We pretend that we don't need to worry about them. Therefore we don't support inline assemblies.
-  // We assume caller-save general-purpose except for EAX.
-  LiveRange(MachineFunction &Fn, InstrToRegMap &insLiveBeforeMap, InstrToRDfactMap &insRDbeforeMap)
-  {
-    // 1. Build initial live ranges
-    // For each CFG node D that defines variable x, the initial live range for D consists of: 
-    // ( <x>, <{D} union {N | x in N.live-before and D in N.reaching-defs-before}> ) 
-    // x in N.live-before means that x is used in N or after,
-    // D in N.reaching-defs-before means that the use of x in N really is defined by D
-    // Due to LLVM's single assignment nature, I don't think it's necessary to compute reaching defs.
+    // the regs live at the insertion point are exactly those live into
+    // s, and s's region gives them distinct registers
+    MachineBasicBlock *bb;
+    MachineBasicBlock::iterator I;
+    if (s->pred_size() == 1) {
+      bb = s;
+      I = s->begin();
+      while (I != s->end() && I->isLabel())
+        ++I;
+    } else if (canPlaceAtEnd(p)) {
+      bb = p;
+      I = p->getFirstTerminator();
+    } else {
+      bb = splitEdge(p, s);
+      I = bb->getFirstTerminator();
+    }
 
-    // 2. Convert initial live ranges to final live ranges (collapse overlapping initial live ranges for the same variable):
-    // LLVM IR has true SSA due to phi nodes, but phi nodes have been eliminated in the lowered representation.
-    // So it's possible that x is defined twice in two branches.
+    MachineRegisterInfo &MRI = MF.getRegInfo();
+    unsigned n = 0;
+    for (unsigned i = 0; i < stores.size(); i++, n++)
+      TII->storeRegToStackSlot(*bb, I, stores[i].from, false, stores[i].slot,
+                               MRI.getRegClass(stores[i].reg));
 
-    // We combine the two steps into one.
-    for (MachineFunction::iterator b = Fn.begin(), e = Fn.end(); b != e; ++b)
-      for (MachineBasicBlock::iterator D = b->begin(), e = b->end(); D != e; ++D) {
-        int n = D->getNumOperands();
-        for (int j = 0; j < n; j++) {
-          MachineOperand op = D->getOperand(j);  
-          if (op.isReg() && op.getReg() && op.isDef()) {
-            unsigned x = op.getReg();
-            if (TargetRegisterInfo::isPhysicalRegister(x))
-              continue;
-
-            set<MachineInstr *> *s = range[x];
-            if (!s) {
-              s = new set<MachineInstr *>();
-              range[x] = s;
-            }
-            s->insert(D);
-            for (MachineFunction::iterator b = Fn.begin(), e = Fn.end(); b != e; ++b)
-              for (MachineBasicBlock::iterator N = b->begin(), e = b->end(); N != e; ++N)
-                if (insLiveBeforeMap[N]->count(x))
-                  s->insert(N);
-            }
-          } // end iterating operands
-      } // end iterating instructions and blocks
-  }
-
-  void debug(map<MachineInstr *, unsigned> &InstrToNumMap)
-  {
-    errs() << "\n\nLIVE RANGES\n";
-    map<const unsigned, set<MachineInstr *>*>::iterator p, e;
-    for (p = range.begin(), e = range.end(); p != e; ++p) {
-      errs() << p->first << ": {";
-      set<MachineInstr *> *s = p->second;
-      set<MachineInstr *>::iterator i = s->begin(), e = s->end();
-      for(; i != e; ++i)
-        errs() << " %" << InstrToNumMap[*i];
-      errs() << " }\n";
+    // a copy may go once no other pending copy reads a register that
+    // overlaps its destination; when only cycles are left, one source
+    // waits in a new stack slot and is loaded with the rest
+    while (!copies.empty()) {
+      bool progress = false;
+      for (unsigned i = 0; i < copies.size(); ) {
+        bool blocked = false;
+        for (unsigned j = 0; j < copies.size() && !blocked; j++)
+          blocked = j != i && aliasMatrix.overlaps(copies[i].to,
+                                                   copies[j].from);
+        if (blocked) {
+          i++;
+          continue;
+        }
+        const TargetRegisterClass *RC = MRI.getRegClass(copies[i].reg);
+        if (!TII->copyRegToReg(*bb, I, copies[i].to, copies[i].from, RC, RC))
+          llvm_report_error("Gcra: cannot copy between registers in function " +
+                            MF.getFunction()->getName().str());
+        MRI.setPhysRegUsed(copies[i].to);
+        copies.erase(copies.begin() + i);
+        progress = true;
+        n++;
+      }
+      if (!progress) {
+        Move M = copies.back();
+        copies.pop_back();
+        const TargetRegisterClass *RC = MRI.getRegClass(M.reg);
+        M.slot = MF.getFrameInfo()->CreateSpillStackObject(RC->getSize(),
+                                                           RC->getAlignment());
+        TII->storeRegToStackSlot(*bb, I, M.from, false, M.slot, RC);
+        loads.push_back(M);
+        n++;
+      }
+    }
+
+    for (unsigned i = 0; i < loads.size(); i++, n++) {
+      TII->loadRegFromStackSlot(*bb, I, loads[i].to, loads[i].slot,
+                                MRI.getRegClass(loads[i].reg));
+      MRI.setPhysRegUsed(loads[i].to);
     }
+    return n;
+  }
+
+  //**********************************************************************
+  // splitEdge
+  //
+  // put a new, empty block on edge p -> s (see canSplit), in the
+  // innermost loop that holds both, and return it
+  //**********************************************************************
+  MachineBasicBlock *splitEdge(MachineBasicBlock *p, MachineBasicBlock *s) {
+    MachineBasicBlock *N = MF.CreateMachineBasicBlock();
+    // if p may fall through to s, it now falls through to N
+    MachineFunction::iterator at = p;
+    if (p->isLayoutSuccessor(s))
+      ++at;
+    else
+      at = MF.end();
+    MF.insert(at, N);
+    p->ReplaceUsesOfBlockWith(s, N);
+    N->addSuccessor(s);
+    if (!N->isLayoutSuccessor(s)) {
+      SmallVector<MachineOperand, 1> noCond;
+      TII->InsertBranch(*N, s, 0, noCond);
+    }
+    MachineLoop *L = loopInfo->getLoopFor(p);
+    while (L && !L->contains(s))
+      L = L->getParentLoop();
+    if (L)
+      L->addBasicBlockToLoop(N, loopInfo->getBase());
+    numSplits++;
+    return N;
   }
 };
 
 namespace {
   class Gcra : public MachineFunctionPass {
   private:
+    //**********************************************************************
+    // LiveVarsProblem
+    //
+    // live variables over the dense register indexes: backward, union;
+    //   bb.gen = all upwards-exposed uses in bb
+    //   bb.kill = all defs in bb
+    // and for one instruction
+    //   live-before = (live-after - kill) union gen
+    // where kill is the regs defined by inst (if any) and gen is all
+    // reg-use operands of inst, both including aliases
+    //**********************************************************************
+    struct LiveVarsProblem {
+      static const DataFlowDirection direction = BACKWARD;
+      static const DataFlowMeet meet = MEET_UNION;
+
+      Gcra &G;
+      LiveVarsProblem(Gcra &g) : G(g) {}
+
+      unsigned getNumFacts() { return G.regNums.size(); }
+
+      void getBlockGenKill(MachineBasicBlock *bb, BitSet &gen, BitSet &kill) {
+	G.getUpwardsExposedUses(bb, gen);
+	G.getAllDefs(bb, kill);
+      }
+
+      void transfer(MachineInstr *inst, BitSet &live) {
+	const OperandSummary &ops = G.operands;
+	unsigned r = ops.getRecord(inst);
+	for (OperandSummary::iterator d = ops.def_begin(r), e = ops.def_end(r);
+	     d != e; ++d)
+	  live.reset(*d);
+	for (OperandSummary::iterator u = ops.use_begin(r), e = ops.use_end(r);
+	     u != e; ++u)
+	  live.set(*u);
+      }
+    };
+
+    //**********************************************************************
+    // RDefsProblem
+    //
+    // reaching defs over the RDfact IDs: forward, union;
+    //   bb.gen = for each reg v defined in bb at inst: the RDfact
+    //            (v, inst), if it reaches the end of bb
+    //   bb.kill = all dataflow facts with reg v
+    // and for one instruction
+    //   RDafter = (RDbefore - kill) union gen
+    // where kill is all dataflow facts with the regs that are defined by
+    // inst (if any), and gen is the set of facts (reg, inst) for all regs
+    // defined by inst (if any)
+    //**********************************************************************
+    struct RDefsProblem {
+      static const DataFlowDirection direction = FORWARD;
+      static const DataFlowMeet meet = MEET_UNION;
+
+      Gcra &G;
+      RDefsProblem(Gcra &g) : G(g) {}
+
+      unsigned getNumFacts() { return G.RDfacts.size(); }
+
+      void getBlockGenKill(MachineBasicBlock *bb, BitSet &gen, BitSet &kill) {
+	G.getRDgen(bb, gen);
+	G.getRDkill(bb, kill);
+      }
+
+      void transfer(MachineInstr *inst, BitSet &RD) {
+	G.genKillRDfacts(inst, RD);
+      }
+    };
+
+    typedef DataFlowGraph<MachineFunction> MachineGraph;
+
     const TargetRegisterInfo *TRI;
+    const TargetInstrInfo *TII;
+    const AliasMatrix *aliasMatrix;
+    MachineLoopInfo *loopInfo;
     
-    static const bool DEBUG_LIVE = false;
-    static const bool DEBUG_RD = false;    
-    // LLVM can output instructions after each stage:  -print-machineinstrs
-    static const bool PRINT_INST = true;
-    static const bool DEBUG_RANGE = true;
-    static const bool DEBUG_GRAPH = true;
-    
+    // -time-passes timers for the steps of allocateRound, summed over
+    // all rounds and functions
+    TimerGroup timers;
+    Timer initTimer, liveTimer, RDtimer, webTimer, rangeTimer, graphTimer,
+      coalesceTimer, colorTimer, linearScanTimer, regionTimer, slotTimer;
+
     int numRegClasses;
     
-    set<RDfact *> RDfactSet;
+    RDfactTable RDfacts;
     
     map<MachineInstr *, unsigned> InstrToNumMap;
+
+    RegNumbering regNums;
+
+    // the use/def regs of every instruction, decoded once per round
+    OperandSummary operands;
+
+    // owns every per-function set below; reset at the start of each fn
+    Arena arena;
     
     BBtoRegMap liveBeforeMap;
     BBtoRegMap liveAfterMap;
     BBtoRegMap liveVarsGenMap;
     BBtoRegMap liveVarsKillMap;
-    InstrToRegMap insLiveBeforeMap;
-    InstrToRegMap insLiveAfterMap;
     
     BBtoRDfactMap RDbeforeMap;
     BBtoRDfactMap RDafterMap;
     BBtoRDfactMap RDgenMap;
     BBtoRDfactMap RDkillMap;
-    InstrToRDfactMap insRDbeforeMap;
-    InstrToRDfactMap insRDafterMap;
+
+    // instruction-level sets are computed on demand from the block
+    // sets above (see InstrSetCache); new'd per round.  liveCache
+    // serves spill placement and range splitting, and spillAndUpdate
+    // invalidates the blocks it patches; RDcache serves web splitting
+    // and coalescing, which start a new round when they change Fn
+    LiveVarsProblem liveProblem;
+    RDefsProblem RDproblem;
+    InstrSetCache<MachineGraph, LiveVarsProblem> *liveCache;
+    InstrSetCache<MachineGraph, RDefsProblem> *RDcache;
+
+    // vregs created by spillReg; they must never be spilled themselves
+    set<unsigned> spillTemps;
+
+    // vregs made or changed by splitRanges; they are spilled, not split
+    // again, if they get no register
+    set<unsigned> splitVRegs;
+
+    // a spill temp, as logged by spillReg and rematerializeReg
+    struct SpillTemp {
+      unsigned reg;
+      MachineInstr *user;         // the instruction it stands in for a vreg
+      bool isUse, isDef;          // does user read it, write it
+      MachineInstr *load;         // the reload (or recomputation), or 0
+      MachineInstr *store;        // the store after user, or 0
+    };
+
+    // the graph of the last coloring round and its class info; after a
+    // spill, spillAndUpdate patches the graph and sets incremental, and
+    // the next round only colors again.  Both point into the arena.
+    Graph *graph;
+    RegClassInfo *classes;
+    bool incremental;
+
+    // where spillReg logs the temps it creates, if not 0
+    vector<SpillTemp> *spillLog;
+
+    // by dense index: the single def of a vreg that can be recomputed
+    // instead of reloaded, or 0 (see findRematDefs)
+    vector<MachineInstr *> rematDefs;
+
+    // copies removed by coalescing so far in this function
+    unsigned numCoalesced;
+
+    // splitWebs has run on this function
+    bool websSplit;
+
+    // allocate the rest of this function by linear scan (see
+    // useLinearScan); once set it stays set until the next function
+    bool linearScan;
+    sys::TimeValue startTime;
+
+    // color this round region by region (see RegionAllocator)
+    bool regionMode;
+
+    // the vregs region mode keeps in memory in some regions
+    RegionSpills regionSpills;
     
   public:
     static char ID; // Pass identification, replacement for typeid
@@ -190,9 +2342,41 @@ namespace {
     //**********************************************************************
     // constructor
     //**********************************************************************
-    Gcra() : MachineFunctionPass(&ID) {
+    Gcra() : MachineFunctionPass(&ID),
+	     timers("Graph-coloring register allocation"),
+	     initTimer("Init (numbering, operand records)", timers),
+	     liveTimer("Live variables", timers),
+	     RDtimer("Reaching defs", timers),
+	     webTimer("Web splitting", timers),
+	     rangeTimer("Live ranges", timers),
+	     graphTimer("Interference graph", timers),
+	     coalesceTimer("Coalescing", timers),
+	     colorTimer("Coloring, spilling and rewriting", timers),
+	     linearScanTimer("Linear scan, spilling and rewriting", timers),
+	     regionTimer("Region coloring, spilling and rewriting", timers),
+	     slotTimer("Spill-slot coloring", timers),
+	     liveProblem(*this), RDproblem(*this), liveCache(0), RDcache(0),
+	     graph(0), classes(0), spillLog(0) {
       numRegClasses = 0;
     }
+
+    virtual void releaseMemory() {
+      delete liveCache;
+      delete RDcache;
+      delete graph;
+      delete classes;
+      liveCache = 0;
+      RDcache = 0;
+      graph = 0;
+      classes = 0;
+    }
+
+    // the clobber sets of the last module name functions that may be
+    // gone, and a new function may reuse one's address
+    virtual bool doInitialization(Module &M) {
+      ClobberRegistry::get().clear();
+      return false;
+    }
     
     //**********************************************************************
     // runOnMachineFunction
@@ -203,13 +2387,119 @@ namespace {
       // get pointer to regster info, which doesn't change over this fn
       // Defined in a table, e.g. lib/Target/X86/X86RegisterInfo.td
       TRI = Fn.getTarget().getRegisterInfo();
+      TII = Fn.getTarget().getInstrInfo();
+      aliasMatrix = &AliasMatrix::get(TRI);
+      loopInfo = &getAnalysis<MachineLoopInfo>();
 
       // LLVM divides its virtual registers into one or more classes.
       // Each class has a (not necessarily disjoint) set of physical registers to which it can be allocated.
       numRegClasses = TRI->getNumRegClasses();
-      
-      // INITIALIZE FOR EACH FN
-      RDfactSet.clear();
+
+      spillTemps.clear();
+      numCoalesced = 0;
+      websSplit = false;
+      incremental = false;
+      splitVRegs.clear();
+      linearScan = false;
+      regionMode = false;
+      regionSpills.clear();
+      startTime = sys::TimeValue::now();
+
+      if (IPRA)
+	countCalleeClobbers(Fn);
+
+      // Repeat steps 1-6 until the graph colors; each failed round
+      // either coalesces copies or inserts spill code for the vregs
+      // that got no register.  After spill code the graph is usually
+      // patched in place, and the next round only repeats step 6.
+      unsigned round = 1;
+      while (!allocateRound(Fn, round))
+        round++;
+
+      // Every spilled vreg got a slot of its own; share the slots of
+      // values that are never live at once.
+      TraceSpan span(Fn.getFunction()->getName());
+      startPhase(span, "gcra.slots", slotTimer);
+      SpillSlotColoring slots(Fn);
+      slots.run();
+      stopTimer(slotTimer);
+      span.addArg("slots", slots.getNumSlots());
+      span.addArg("removed", slots.getNumRemoved());
+      span.addArg("bytesbefore", slots.getBytesBefore());
+      span.addArg("bytesafter", slots.getBytesAfter());
+      span.end();
+      slots.report();
+
+      if (IPRA)
+	ClobberRegistry::get().record(Fn, TRI, *aliasMatrix);
+
+      if (DEBUG_COALESCE)
+	errs() << "COALESCED " << numCoalesced << " copies in "
+	       << Fn.getFunction()->getName() << "\n";
+
+      if (linearScan)
+	++NumLinearScanFns;
+      else if (regionMode)
+	++NumRegionFns;
+      else
+	++NumColoredFns;
+      DEBUG(errs() << "Gcra: " << Fn.getFunction()->getName()
+	           << (linearScan ? " allocated by linear scan" :
+		       regionMode ? " colored region by region"
+		                  : " allocated by graph coloring")
+		   << " in " << round << " rounds\n");
+
+      return true;
+    }
+
+    //**********************************************************************
+    // countCalleeClobbers
+    //
+    // count the direct calls to allocated functions of this module, and
+    // the implicit defs of those calls that decoding will leave out
+    // because the callee never writes them (see ClobberRegistry)
+    //**********************************************************************
+    void countCalleeClobbers(MachineFunction &Fn) {
+      const ClobberRegistry &registry = ClobberRegistry::get();
+      for (MachineFunction::iterator bb = Fn.begin(), bbe = Fn.end();
+	   bb != bbe; bb++) {
+	for (MachineBasicBlock::iterator I = bb->begin(), E = bb->end();
+	     I != E; ++I) {
+	  const BitSet *clobbers = registry.getCallClobbers(I);
+	  if (!clobbers)
+	    continue;
+	  ++NumIPRACalls;
+	  for (unsigned i = 0, e = I->getNumOperands(); i != e; i++) {
+	    const MachineOperand &MOp = I->getOperand(i);
+	    if (MOp.isReg() && MOp.isDef() && MOp.isImplicit() &&
+		TargetRegisterInfo::isPhysicalRegister(MOp.getReg()) &&
+		!clobbers->test(MOp.getReg()))
+	      ++NumIPRARegs;
+	  }
+	}
+      }
+    }
+
+    //**********************************************************************
+    // allocateRound
+    //
+    // run one round of analysis and coloring on Fn; if every vreg got a
+    // register, rewrite Fn and return true, otherwise coalesce copies or
+    // spill the vregs that got no register and return false
+    //**********************************************************************
+    bool allocateRound(MachineFunction &Fn, unsigned round) {
+      // after a spill the graph was patched in place (see
+      // spillAndUpdate), so only coloring has to be redone, unless the
+      // time budget says to switch to linear scan
+      if (incremental && useLinearScan())
+	incremental = false;
+      if (incremental) {
+	TraceSpan span(Fn.getFunction()->getName());
+	++NumPatchedRounds;
+	return colorGraph(Fn, span, round);
+      }
+
+      // INITIALIZE FOR EACH ROUND
       RDbeforeMap.clear();
       RDafterMap.clear();
       InstrToNumMap.clear();
@@ -217,69 +2507,773 @@ namespace {
       liveAfterMap.clear();
       liveVarsGenMap.clear();
       liveVarsKillMap.clear();
-      insLiveBeforeMap.clear();
-      insLiveAfterMap.clear();
       
       RDbeforeMap.clear();
       RDafterMap.clear();
       RDgenMap.clear();
       RDkillMap.clear();
-      insRDbeforeMap.clear();
-      insRDafterMap.clear();
+      releaseMemory();
+
+      // all containers that point into the arena are empty now, so all
+      // of the previous round's analysis storage can be dropped at once
+      arena.reset();
       
       
+      // one -p1-trace span per step
+      TraceSpan span(Fn.getFunction()->getName());
+
       // STEP 1: get sets of regs, set of defs, set of RDfacts,
-      //         instruction-to-number map
+      //         instruction-to-number map, operand records
+      startPhase(span, "gcra.init", initTimer);
       doInit(Fn);
+      stopTimer(initTimer);
+      span.addArg("round", round);
+      span.addArg("instrs", InstrToNumMap.size());
+      span.addArg("blocks", Fn.size());
+      span.addArg("regs", regNums.size());
+      span.addArg("rdfacts", RDfacts.size());
+      if (!linearScan && useLinearScan())
+	linearScan = true;
+      regionMode = !linearScan && REGION_BLOCKS && Fn.size() > REGION_BLOCKS;
+      if (regionMode &&
+	  !RegionAllocator::canTile(Fn, loopInfo, TII, REGION_BLOCKS)) {
+	regionMode = false;
+	linearScan = true;
+      }
+      span.addArg("linearscan", linearScan);
+      span.addArg("regionmode", regionMode);
+      span.end();
 
       // if debugging, print all instructions to stdout
       if (PRINT_INST) {
 	errs() << "START INITIAL INSTRUCTIONS FOR " << Fn.getFunction()->getName()
-	     << "\n";
+	     << " (ROUND " << round << ")\n";
 	printInstructions(Fn);
       }
 
       // LLVM also comes with the analysis in lib/CodeGen/LiveVariables.cpp
 
       // STEP 2: live analysis for all registers (fill in globals
-      //         liveBeforeMap and liveAfterMap for blocks, and
-      //         globals insLiveBeforeMap and insLiveAfterMapfor
-      //         instructions)
-      doLiveAnalysis(Fn);
+      //         liveBeforeMap and liveAfterMap for blocks; liveCache
+      //         answers queries for instructions)
+      startPhase(span, "gcra.liveness", liveTimer);
+      unsigned visits = doLiveAnalysis(Fn);
+      stopTimer(liveTimer);
+      span.addArg("regs", regNums.size());
+      span.addArg("visits", visits);
+      span.end();
       if (DEBUG_LIVE) {
 	printLiveResults(Fn);
       }
       
       // STEP 3: reaching defs analysis (fill in globals RDbeforeMap and
-      //         RDafterMap for blocks, and globals insRDbeforeMap and
-      //         insRDafterMap for instructions)
-      doReachingDefsAnalysis(Fn);
-      if (DEBUG_RD) {
-	printRDResults(Fn);
+      //         RDafterMap for blocks; RDcache answers queries for
+      //         instructions); web splitting (3b) and coalescing read
+      //         them.  Linear scan and region modes skip both: they are
+      //         for functions too big for a set of RDfacts per block,
+      //         they do not coalesce, and their live ranges and
+      //         graphs stay correct for vregs with several webs, only
+      //         less precise
+      if (!linearScan && !regionMode) {
+	startPhase(span, "gcra.rd", RDtimer);
+	visits = doReachingDefsAnalysis(Fn);
+	stopTimer(RDtimer);
+	span.addArg("rdfacts", RDfacts.size());
+	span.addArg("visits", visits);
+	span.end();
+	if (DEBUG_RD) {
+	  printRDResults(Fn);
+	}
       }
 
-      // LLVM also has this live interval analysis
+      // STEP 3b: give every web its own vreg, once per function (the
+      //          spill code and coalescing of later rounds never join
+      //          unrelated defs); renaming changes the live ranges, so
+      //          start a new round if any vreg was split
+      if (!linearScan && !regionMode && !websSplit) {
+	startPhase(span, "gcra.webs", webTimer);
+	unsigned n = splitWebs(Fn);
+	websSplit = true;
+	stopTimer(webTimer);
+	span.addArg("newvregs", n);
+	span.end();
+	if (n) {
+	  NumWebs += n;
+	  return false;
+	}
+      }
+
+      // LLVM also has this live interval analysis
+
+      // STEP 4: Compute initial and final live ranges for every definition of a register in the function.
+      startPhase(span, "gcra.ranges", rangeTimer);
+      LiveRange liveRange(Fn, liveAfterMap, InstrToNumMap, regNums,
+			  operands, arena);
+      stopTimer(rangeTimer);
+      span.addArg("intervals", liveRange.range.size());
+      span.end();
+      if (DEBUG_RANGE)
+        liveRange.debug();
+
+      // STEPS 5-7 in linear scan mode: assign registers straight from
+      //         the live ranges, with no interference graph
+      if (linearScan) {
+	startPhase(span, "gcra.linearscan", linearScanTimer);
+	RegClassInfo classes(Fn, TRI, *aliasMatrix);
+	vector<float> spillCost;
+	computeSpillCosts(Fn, spillCost);
+	LinearScan scan(Fn, liveRange, regNums, classes, *aliasMatrix,
+			spillCost);
+	bool done = scan.run();
+	if (DEBUG_COLOR)
+	  scan.debug();
+	span.addArg("vregs", scan.getNumVRegs());
+	span.addArg("spilled", scan.getSpilled().size());
+	if (!done) {
+	  spillRegs(Fn, scan.getSpilled());
+	  stopTimer(linearScanTimer);
+	  return false;
+	}
+	NumVRegs += scan.getNumVRegs();
+	rewriteRegisters(Fn, scan.getColors());
+	stopTimer(linearScanTimer);
+	return true;
+      }
+
+      // STEPS 5-7 in region mode: build and color one graph per region
+      //         of blocks, spill in the regions that ran out, rewrite
+      //         each region with its own colors and reconcile them on
+      //         the edges between regions; coalescing would need the
+      //         whole graph
+      if (regionMode) {
+	startPhase(span, "gcra.regions", regionTimer);
+	RegClassInfo classes(Fn, TRI, *aliasMatrix);
+	RegionAllocator regions(Fn, liveBeforeMap, liveAfterMap, regNums,
+				operands, classes, *aliasMatrix, loopInfo, TII,
+				spillTemps, regionSpills, REGION_BLOCKS);
+	bool done = regions.run();
+	if (DEBUG_COLOR)
+	  regions.debug();
+	NumEdges += regions.getNumEdges();
+	span.addArg("regions", regions.getNumRegions());
+	span.addArg("maxnodes", regions.getMaxNodes());
+	span.addArg("vregs", regions.getNumVRegs());
+	span.addArg("spilled", regions.getSpilled().size());
+	if (!done) {
+	  spillInRegions(Fn, regions);
+	  if (overTimeBudget())
+	    linearScan = true;
+	  stopTimer(regionTimer);
+	  return false;
+	}
+	NumVRegs += regions.getNumVRegs();
+	vector<unsigned> color(regNums.size(), 0);
+	for (unsigned r = 0; r < regions.getNumRegions(); r++) {
+	  regions.getColors(r, color);
+	  const vector<MachineBasicBlock *> &blocks = regions.getBlocks(r);
+	  for (unsigned b = 0; b < blocks.size(); b++)
+	    rewriteBlock(*blocks[b], color);
+	}
+	unsigned n = regions.placeBoundaryCode();
+	NumRegionMoves += n;
+	span.addArg("boundarymoves", n);
+	span.addArg("splitedges", regions.getNumSplits());
+	stopTimer(regionTimer);
+	return true;
+      }
+
+      // STEP 5: Build the interference graph
+      startPhase(span, "gcra.graph", graphTimer);
+      classes = new RegClassInfo(Fn, TRI, *aliasMatrix);
+      graph = new Graph(Fn, liveAfterMap, regNums, operands, *classes,
+			*aliasMatrix, TII, arena);
+      stopTimer(graphTimer);
+      NumEdges += graph->getNumEdges();
+      span.addArg("nodes", graph->getNumNodes());
+      span.addArg("edges", graph->getNumEdges());
+      span.end();
+      if (DEBUG_GRAPH)
+        graph->debug();
+
+      // STEP 5b: Coalesce copies; renaming changes the live ranges, so
+      //          start a new round if any copy was removed
+      startPhase(span, "gcra.coalesce", coalesceTimer);
+      Coalescer coalescer(Fn, *graph, regNums, *classes, TII, loopInfo,
+			  spillTemps, arena);
+      unsigned n = coalescer.run();
+      if (n)
+	coalescer.apply();
+      stopTimer(coalesceTimer);
+      span.addArg("coalesced", n);
+      span.end();
+      if (n) {
+	numCoalesced += n;
+	NumCoalesced += n;
+	return false;
+      }
+
+      return colorGraph(Fn, span, round);
+    }
+
+    //**********************************************************************
+    // colorGraph
+    //
+    // STEPS 6-7 on the graph of this round (built, or patched after the
+    // last spill); on failure spill and patch the graph for the next
+    // round, if possible
+    //**********************************************************************
+    bool colorGraph(MachineFunction &Fn, TraceSpan &span, unsigned round) {
+      // STEP 6: Color the graph (simplify/select), choosing spill
+      //         candidates by loop-weighted cost
+      startPhase(span, "gcra.coloring", colorTimer);
+      span.addArg("round", round);
+      span.addArg("incremental", incremental);
+      vector<float> spillCost;
+      computeSpillCosts(Fn, spillCost);
+      Coloring coloring(Fn, *graph, regNums, *classes, spillCost);
+      bool colored = coloring.run();
+      if (DEBUG_COLOR)
+        coloring.debug();
+      span.addArg("vregs", coloring.getNumVRegs());
+      span.addArg("spilled", coloring.getSpilled().size());
+      if (!colored) {
+	// splitting changes liveness across blocks, which the graph
+	// cannot be patched for
+	vector<unsigned> rest;
+	unsigned n = splitRanges(Fn, coloring.getSpilled(), spillCost, rest);
+	span.addArg("split", n);
+	if (n) {
+	  spillRegs(Fn, rest);
+	  incremental = false;
+	} else {
+	  incremental = spillAndUpdate(Fn, rest);
+	}
+	// a function that keeps spilling switches as soon as its time is
+	// up, not only when the next round starts
+	if (overTimeBudget()) {
+	  linearScan = true;
+	  incremental = false;
+	}
+	stopTimer(colorTimer);
+	return false;
+      }
+      NumVRegs += coloring.getNumVRegs();
+
+      // STEP 7: Replace vregs by the registers they were given
+      rewriteRegisters(Fn, coloring.getColors());
+      stopTimer(colorTimer);
+      
+      return true;
+    }
+    
+    //**********************************************************************
+    // useLinearScan
+    //
+    // should the current function be allocated by linear scan: it has
+    // more instructions or vregs than coloring is allowed to handle, more
+    // regs than an interference graph can hold (Graph::MAX_NODES), or
+    // its rounds so far have used up the time budget
+    //**********************************************************************
+    bool useLinearScan() {
+      if (InstrToNumMap.size() > LINEAR_SCAN_INSTRS)
+	return true;
+      unsigned numVRegs = 0;
+      for (unsigned idx = 0; idx < regNums.size(); idx++)
+	if (TargetRegisterInfo::isVirtualRegister(regNums.getReg(idx)))
+	  numVRegs++;
+      if (numVRegs > LINEAR_SCAN_VREGS || regNums.size() > Graph::MAX_NODES)
+	return true;
+      return overTimeBudget();
+    }
+
+    // has the current function used up the -gcra-time-budget
+    bool overTimeBudget() {
+      if (!TIME_BUDGET)
+	return false;
+      sys::TimeValue elapsed = sys::TimeValue::now() - startTime;
+      uint64_t ms = elapsed.seconds() * 1000 + elapsed.microseconds() / 1000;
+      return ms > TIME_BUDGET;
+    }
+
+    //**********************************************************************
+    // spillRegs
+    //
+    // insert spill code for the vregs (dense indexes) that got no
+    // register this round
+    //**********************************************************************
+    void spillRegs(MachineFunction &Fn, const vector<unsigned> &spilled) {
+      for (unsigned i = 0; i < spilled.size(); i++) {
+	unsigned reg = regNums.getReg(spilled[i]);
+	// a spill temp lives only between two adjacent instructions;
+	// if even that cannot be colored, spilling cannot help
+	if (spillTemps.count(reg))
+	  llvm_report_error("Gcra: ran out of registers in function " +
+			    Fn.getFunction()->getName().str());
+	if (MachineInstr *def = rematDefs[spilled[i]]) {
+	  rematerializeReg(Fn, reg, def);
+	  ++NumRemats;
+	} else {
+	  spillReg(Fn, reg);
+	}
+	++NumSpills;
+      }
+    }
+
+    //**********************************************************************
+    // spillInRegions
+    //
+    // keep each vreg that got no register in a region in memory there:
+    // spill code for it goes into that region's blocks only, using the
+    // one stack slot it has in every region (see RegionSpills), and the
+    // boundary code moves it between the slot and the registers other
+    // regions give it
+    //**********************************************************************
+    void spillInRegions(MachineFunction &Fn, const RegionAllocator &regions) {
+      const vector<pair<unsigned, unsigned> > &spilled = regions.getSpilled();
+      for (unsigned i = 0; i < spilled.size(); i++) {
+	unsigned r = spilled[i].first, reg = regNums.getReg(spilled[i].second);
+	if (spillTemps.count(reg))
+	  llvm_report_error("Gcra: ran out of registers in function " +
+			    Fn.getFunction()->getName().str());
+	map<unsigned, int>::iterator slot = regionSpills.slots.find(reg);
+	if (slot == regionSpills.slots.end()) {
+	  const TargetRegisterClass *RC = Fn.getRegInfo().getRegClass(reg);
+	  int FI = Fn.getFrameInfo()->CreateSpillStackObject(RC->getSize(),
+							     RC->getAlignment());
+	  slot = regionSpills.slots.insert(make_pair(reg, FI)).first;
+	}
+	if (DEBUG_SPILL)
+	  errs() << "SPILL " << reg << " in region " << regions.getKey(r)
+		 << " to stack slot " << slot->second << "\n";
+	regionSpills.inMemory.insert(make_pair(regions.getKey(r), reg));
+
+	const vector<MachineBasicBlock *> &blocks = regions.getBlocks(r);
+	for (unsigned b = 0; b < blocks.size(); b++)
+	  for (MachineBasicBlock::iterator inIt = blocks[b]->begin();
+	       inIt != blocks[b]->end(); inIt++)
+	    spillInstr(*blocks[b], inIt, reg, slot->second);
+	++NumSpills;
+      }
+    }
+
+    //**********************************************************************
+    // splitRanges
+    //
+    // of the vregs that got no register, split those for which it is
+    // cheaper than spilling them everywhere (by the loop-weighted counts
+    // of computeSpillCosts), and append the others to rest; return the
+    // number split.  A vreg can be split
+    //  - around a loop: inside the loop it becomes a new vreg, loaded
+    //    in the preheader and stored after each def, that is colored on
+    //    its own; outside the loop it is spilled, so it keeps its
+    //    register where it is hot and lives in memory where it is cold
+    //  - around the calls it is live across: stored just before each
+    //    call and reloaded just after it, so it no longer interferes
+    //    with the registers the calls clobber
+    //**********************************************************************
+    unsigned splitRanges(MachineFunction &Fn, const vector<unsigned> &spilled,
+			 const vector<float> &cost, vector<unsigned> &rest) {
+      vector<bool> isCandidate(regNums.size(), false);
+      vector<unsigned> candidates;
+      for (unsigned i = 0; i < spilled.size(); i++) {
+	unsigned reg = regNums.getReg(spilled[i]);
+	// spill temps cannot get any shorter, and rematerializing is
+	// cheaper than splitting
+	if (!SPLIT || spillTemps.count(reg) || splitVRegs.count(reg) ||
+	    rematDefs[spilled[i]]) {
+	  rest.push_back(spilled[i]);
+	} else {
+	  isCandidate[spilled[i]] = true;
+	  candidates.push_back(spilled[i]);
+	}
+      }
+      if (candidates.empty())
+	return 0;
+
+      // the instructions that mention each candidate, and the calls it
+      // is live across (as liveCache has the sets after them)
+      map<unsigned, vector<MachineInstr *> > occurs, crossed;
+      for (MachineFunction::iterator bb = Fn.begin(), bbe = Fn.end();
+	   bb != bbe; bb++) {
+	MachineBasicBlock::iterator N = bb->end();
+	while (N != bb->begin()) {
+	  --N;
+	  unsigned r = operands.getRecord(N);
+	  if (N->getDesc().isCall()) {
+	    const BitSet &live = liveCache->getAfter(N);
+	    for (unsigned c = 0; c < candidates.size(); c++)
+	      if (live.test(candidates[c]) && !defines(r, candidates[c]))
+		crossed[candidates[c]].push_back(N);
+	  }
+	  for (OperandSummary::iterator u = operands.use_begin(r),
+		 e = operands.def_end(r); u != e; ++u) {
+	    if (!isCandidate[*u])
+	      continue;
+	    vector<MachineInstr *> &occ = occurs[*u];
+	    if (occ.empty() || occ.back() != N)
+	      occ.push_back(N);
+	  }
+	}
+      }
+
+      unsigned numSplit = 0;
+      for (unsigned c = 0; c < candidates.size(); c++) {
+	unsigned idx = candidates[c];
+	const vector<MachineInstr *> &occ = occurs[idx];
+	const vector<MachineInstr *> &calls = crossed[idx];
+
+	float callCost = numeric_limits<float>::infinity();
+	if (!calls.empty()) {
+	  callCost = 0;
+	  for (unsigned i = 0; i < calls.size(); i++)
+	    callCost += 2 * getLoopWeight(loopInfo->getLoopDepth(calls[i]->getParent()));
+	}
+
+	// the loops around any of its instructions, best first
+	MachineLoop *bestLoop = 0;
+	float loopCost = numeric_limits<float>::infinity();
+	set<MachineLoop *> tried;
+	for (unsigned i = 0; i < occ.size(); i++)
+	  for (MachineLoop *L = loopInfo->getLoopFor(occ[i]->getParent());
+	       L && tried.insert(L).second; L = L->getParentLoop()) {
+	    float c = getLoopSplitCost(idx, L, occ);
+	    if (c < loopCost) {
+	      loopCost = c;
+	      bestLoop = L;
+	    }
+	  }
+
+	if (min(callCost, loopCost) >= cost[idx]) {
+	  rest.push_back(idx);
+	  continue;
+	}
+	if (loopCost <= callCost) {
+	  splitAroundLoop(Fn, idx, bestLoop, occ);
+	  ++NumLoopSplits;
+	} else {
+	  splitAroundCalls(Fn, idx, calls);
+	  ++NumCallSplits;
+	}
+	numSplit++;
+      }
+      return numSplit;
+    }
+
+    // does record r define the reg with dense index idx
+    bool defines(unsigned r, unsigned idx) const {
+      for (OperandSummary::iterator d = operands.def_begin(r),
+	     e = operands.def_end(r); d != e; ++d)
+	if (*d == idx)
+	  return true;
+      return false;
+    }
+
+    // does record r read it
+    bool reads(unsigned r, unsigned idx) const {
+      for (OperandSummary::iterator u = operands.use_begin(r),
+	     e = operands.use_end(r); u != e; ++u)
+	if (*u == idx)
+	  return true;
+      return false;
+    }
+
+    // the loop-weighted number of loads and stores splitAroundLoop would
+    // insert, or infinity if the vreg is only mentioned inside L (there
+    // is nothing cold to move to memory) or L has no preheader
+    float getLoopSplitCost(unsigned idx, MachineLoop *L,
+			   const vector<MachineInstr *> &occ) {
+      MachineBasicBlock *pre = L->getLoopPreheader();
+      if (!pre)
+	return numeric_limits<float>::infinity();
+      float total = 0;
+      bool outside = false;
+      for (unsigned i = 0; i < occ.size(); i++) {
+	MachineBasicBlock *bb = occ[i]->getParent();
+	float weight = getLoopWeight(loopInfo->getLoopDepth(bb));
+	unsigned r = operands.getRecord(occ[i]);
+	if (L->contains(bb)) {
+	  if (defines(r, idx))
+	    total += weight;
+	} else {
+	  outside = true;
+	  total += weight * (reads(r, idx) + defines(r, idx));
+	}
+      }
+      if (!outside)
+	return numeric_limits<float>::infinity();
+      if (liveBeforeMap[L->getHeader()->getNumber()].test(idx))
+	total += getLoopWeight(loopInfo->getLoopDepth(pre));
+      return total;
+    }
+
+    // give the vreg with dense index idx a new vreg inside L, loaded
+    // from its stack slot at the end of L's preheader (if it is live
+    // into L) and stored to it after each def in L, and spill it
+    // everywhere else; occ are the instructions that mention it
+    void splitAroundLoop(MachineFunction &Fn, unsigned idx, MachineLoop *L,
+			 const vector<MachineInstr *> &occ) {
+      MachineRegisterInfo &MRI = Fn.getRegInfo();
+      unsigned reg = regNums.getReg(idx);
+      const TargetRegisterClass *RC = MRI.getRegClass(reg);
+      int slot = Fn.getFrameInfo()->CreateSpillStackObject(RC->getSize(),
+							   RC->getAlignment());
+      unsigned inner = MRI.createVirtualRegister(RC);
+      splitVRegs.insert(inner);
+      if (DEBUG_SPILL)
+	errs() << "SPLIT " << reg << " around the loop at BB#"
+	       << L->getHeader()->getNumber() << " as " << inner
+	       << ", stack slot " << slot << "\n";
+
+      for (unsigned i = 0; i < occ.size(); i++) {
+	MachineInstr *MI = occ[i];
+	MachineBasicBlock *bb = MI->getParent();
+	MachineBasicBlock::iterator inIt(MI);
+	if (!L->contains(bb)) {
+	  spillInstr(*bb, inIt, reg, slot);
+	  continue;
+	}
+	bool isDef = false;
+	for (unsigned k = 0; k < MI->getNumOperands(); k++) {
+	  MachineOperand &MOp = MI->getOperand(k);
+	  if (!MOp.isReg() || MOp.getReg() != reg)
+	    continue;
+	  MOp.setReg(inner);
+	  if (MOp.isDef())
+	    isDef = true;
+	}
+	if (isDef)
+	  TII->storeRegToStackSlot(*bb, ++inIt, inner, false, slot, RC);
+      }
+      if (liveBeforeMap[L->getHeader()->getNumber()].test(idx)) {
+	MachineBasicBlock *pre = L->getLoopPreheader();
+	TII->loadRegFromStackSlot(*pre, pre->getFirstTerminator(), inner,
+				  slot, RC);
+      }
+    }
+
+    // store the vreg with dense index idx to a stack slot just before
+    // each of calls and reload it just after, so that it is not live
+    // across any of them
+    void splitAroundCalls(MachineFunction &Fn, unsigned idx,
+			  const vector<MachineInstr *> &calls) {
+      MachineRegisterInfo &MRI = Fn.getRegInfo();
+      unsigned reg = regNums.getReg(idx);
+      const TargetRegisterClass *RC = MRI.getRegClass(reg);
+      int slot = Fn.getFrameInfo()->CreateSpillStackObject(RC->getSize(),
+							   RC->getAlignment());
+      splitVRegs.insert(reg);
+      if (DEBUG_SPILL)
+	errs() << "SPLIT " << reg << " around " << calls.size()
+	       << " calls, stack slot " << slot << "\n";
+
+      for (unsigned i = 0; i < calls.size(); i++) {
+	MachineBasicBlock *bb = calls[i]->getParent();
+	MachineBasicBlock::iterator next(calls[i]);
+	++next;
+	// the call may read reg itself (an indirect call), so the store
+	// does not kill it
+	TII->storeRegToStackSlot(*bb, calls[i], reg, false, slot, RC);
+	TII->loadRegFromStackSlot(*bb, next, reg, slot, RC);
+      }
+    }
+
+    //**********************************************************************
+    // spillAndUpdate
+    //
+    // spill the vregs that got no register, then patch what the next
+    // round needs instead of recomputing it: a spilled vreg leaves the
+    // live sets of the blocks and the graph, and each of its temps,
+    // which lives only between its reload or store and the instruction
+    // it stands in for (never across a block boundary), becomes a node
+    // whose edges are the regs live at that instruction.  Those sets
+    // are read from liveCache, before the spill code goes in, for the
+    // instructions that mention a spilled vreg; the cache then forgets
+    // the blocks whose sets changed.  Return true iff the graph
+    // was patched; if the spill code mentions any reg but its temp (a
+    // target whose reload clobbers a register, say), it cannot be, and
+    // the next round starts from scratch.
+    //**********************************************************************
+    bool spillAndUpdate(MachineFunction &Fn, const vector<unsigned> &spilled) {
+      if (linearScan || regionMode || !graph) {
+	spillRegs(Fn, spilled);
+	return false;
+      }
+      vector<bool> isSpilled(regNums.size(), false);
+      for (unsigned i = 0; i < spilled.size(); i++)
+	isSpilled[spilled[i]] = true;
+
+      // the regs live before and after every instruction that mentions
+      // a spilled vreg (with that instruction's defs, which interfere
+      // with a temp it defines), not counting the spilled vregs
+      DenseMap<MachineInstr *, unsigned> siteOf;
+      vector<pair<BitSet, BitSet> > sites;
+      vector<MachineBasicBlock *> siteBlocks;
+      for (MachineFunction::iterator bb = Fn.begin(), bbe = Fn.end();
+	   bb != bbe; bb++) {
+	unsigned n = sites.size();
+	findSpillSites(bb, isSpilled, siteOf, sites);
+	if (sites.size() != n)
+	  siteBlocks.push_back(bb);
+      }
+      vector<MachineBasicBlock *> liveBlocks;
+      findLiveBlocks(siteBlocks, spilled, liveBlocks);
+
+      vector<SpillTemp> temps;
+      spillLog = &temps;
+      spillRegs(Fn, spilled);
+      spillLog = 0;
+
+      for (unsigned i = 0; i < temps.size(); i++) {
+	if (!mentionsOnly(temps[i].load, temps[i].reg) ||
+	    !mentionsOnly(temps[i].store, temps[i].reg)) {
+	  if (DEBUG_SPILL)
+	    errs() << "SPILL CODE of " << temps[i].reg
+		   << " mentions other registers; rebuilding\n";
+	  return false;
+	}
+      }
+
+      // the graph cannot grow past MAX_NODES; the next round will
+      // switch to linear scan instead
+      if (regNums.size() + temps.size() > Graph::MAX_NODES)
+	return false;
+
+      // decode the new and changed instructions (numbering the temps),
+      // and drop the spilled vregs from the live sets of the blocks they
+      // were live in or mentioned by; no other block changed
+      for (unsigned i = 0; i < temps.size(); i++) {
+	decodeOperands(temps[i].user);
+	if (temps[i].load)
+	  decodeOperands(temps[i].load);
+	if (temps[i].store)
+	  decodeOperands(temps[i].store);
+      }
+      for (unsigned k = 0; k < liveBlocks.size(); k++) {
+	unsigned b = liveBlocks[k]->getNumber();
+	for (unsigned i = 0; i < spilled.size(); i++) {
+	  liveBeforeMap[b].reset(spilled[i]);
+	  liveAfterMap[b].reset(spilled[i]);
+	  liveVarsGenMap[b].reset(spilled[i]);
+	  liveVarsKillMap[b].reset(spilled[i]);
+	}
+	liveCache->invalidate(liveBlocks[k]);
+      }
+
+      // patch the graph: the temps of one instruction all interfere
+      graph->grow();
+      for (unsigned i = 0; i < spilled.size(); i++)
+	graph->removeNode(spilled[i]);
+      vector<vector<unsigned> > tempsAt(sites.size());
+      for (unsigned i = 0; i < temps.size(); i++) {
+	const SpillTemp &T = temps[i];
+	unsigned site = siteOf[T.user];
+	if (T.isUse)
+	  addInterferences(T.reg, sites[site].first, isSpilled);
+	if (T.isDef)
+	  addInterferences(T.reg, sites[site].second, isSpilled);
+	for (unsigned j = 0; j < tempsAt[site].size(); j++)
+	  graph->addInterference(T.reg, tempsAt[site][j]);
+	tempsAt[site].push_back(T.reg);
+      }
+      if (DEBUG_SPILL)
+	errs() << "PATCHED graph with " << temps.size() << " spill temps\n";
+      return true;
+    }
+
+    // record the live sets around the instructions of bb that mention a
+    // spilled vreg, as liveCache has them
+    void findSpillSites(MachineBasicBlock *bb, const vector<bool> &isSpilled,
+			DenseMap<MachineInstr *, unsigned> &siteOf,
+			vector<pair<BitSet, BitSet> > &sites) {
+      for (MachineBasicBlock::iterator N = bb->begin(), E = bb->end();
+	   N != E; ++N) {
+	unsigned r = operands.getRecord(N);
+	bool mentions = false;
+	for (OperandSummary::iterator u = operands.use_begin(r),
+	       e = operands.def_end(r); u != e; ++u)
+	  if (isSpilled[*u])
+	    mentions = true;
+	if (!mentions)
+	  continue;
+	BitSet after(liveCache->getAfter(N));
+	for (OperandSummary::iterator d = operands.def_begin(r),
+	       e = operands.def_end(r); d != e; ++d)
+	  after.set(*d);
+	siteOf[N] = sites.size();
+	sites.push_back(make_pair(BitSet(liveCache->getBefore(N)), after));
+      }
+    }
+
+    // blocks = siteBlocks and every block a spilled vreg is live into
+    // or out of.  Such a block is on a path to a use of the vreg with no
+    // def between, so walking back from the blocks that mention it,
+    // through the predecessors of blocks it is live into, finds them
+    // all without looking at the rest of the function.
+    void findLiveBlocks(const vector<MachineBasicBlock *> &siteBlocks,
+			const vector<unsigned> &spilled,
+			vector<MachineBasicBlock *> &blocks) {
+      set<MachineBasicBlock *> seen(siteBlocks.begin(), siteBlocks.end());
+      blocks = siteBlocks;
+      for (unsigned k = 0; k < blocks.size(); k++) {
+	const BitSet &in = liveBeforeMap[blocks[k]->getNumber()];
+	bool liveIn = false;
+	for (unsigned i = 0; i < spilled.size() && !liveIn; i++)
+	  liveIn = in.test(spilled[i]);
+	if (!liveIn)
+	  continue;
+	for (MachineBasicBlock::pred_iterator p = blocks[k]->pred_begin(),
+	       pe = blocks[k]->pred_end(); p != pe; ++p)
+	  if (seen.insert(*p).second)
+	    blocks.push_back(*p);
+      }
+    }
 
-      // STEP 4: Compute initial and final live ranges for every definition of a register in the function.
-      LiveRange liveRange(Fn, insLiveBeforeMap, insRDbeforeMap);
-      if (DEBUG_RANGE)
-        liveRange.debug(InstrToNumMap);
+    // connect temp to every reg in regs that was not spilled
+    void addInterferences(unsigned temp, const BitSet &regs,
+			  const vector<bool> &isSpilled) {
+      for (int i = regs.findFirst(); i != -1; i = regs.findNext(i))
+	if (!isSpilled[i])
+	  graph->addInterference(temp, regNums.getReg(i));
+    }
 
-      // STEP 5: Build the interference graph
-      // FIXME: Ignored physical registers and alias registers. Assumed all registers belong to GR32 class.
-      Graph graph(liveRange.range);
-      if (DEBUG_GRAPH)
-        graph.debug();
-      
+    // does MI (if any) have no reg operand but reg
+    static bool mentionsOnly(MachineInstr *MI, unsigned reg) {
+      if (!MI)
+	return true;
+      for (unsigned i = 0; i < MI->getNumOperands(); i++) {
+	const MachineOperand &MOp = MI->getOperand(i);
+	if (MOp.isReg() && MOp.getReg() && MOp.getReg() != reg)
+	  return false;
+      }
       return true;
     }
-    
+
+    // start the span and timer of one step
+    void startPhase(TraceSpan &span, const char *name, Timer &T) {
+      span.begin(name);
+      startTimer(T);
+    }
+
+    // time a step only under -time-passes, as the pass managers do
+    void startTimer(Timer &T) {
+      if (TimePassesIsEnabled)
+	T.startTimer();
+    }
+
+    void stopTimer(Timer &T) {
+      if (TimePassesIsEnabled)
+	T.stopTimer();
+    }
+
     virtual void getAnalysisUsage(AnalysisUsage &AU) const {
       // Eliminate PHI nodes before we get the CFG.
       // This works by inserting copies into predecessor blocks.
       // So the code is no longer in SSA form.
       AU.addRequiredID(PHIEliminationID); 
       AU.addRequiredID(TwoAddressInstructionPassID);
+      // loop depths weight the spill costs
+      AU.addRequired<MachineLoopInfo>();
+      AU.addPreserved<MachineLoopInfo>();
       MachineFunctionPass::getAnalysisUsage(AU);
     }
     
@@ -288,12 +3282,23 @@ namespace {
     // doInit
     //
     // fill in
-    //  RDfactSet:     set of all reaching-def facts in this function
+    //  RDfacts:       table of all reaching-def facts in this function
     //  InstrToNumMap: map from instruction to unique # (for debugging)
+    //  regNums:       dense index for every reg (and alias) in this function
+    //  operands:      use/def record of every instruction
     //**********************************************************************
+    // add the operand record of MI; with -gcra-ipra a call to a function
+    // allocated earlier only defines what that function may clobber
+    void decodeOperands(MachineInstr *MI) {
+      operands.add(MI, regNums, *aliasMatrix,
+		   IPRA ? ClobberRegistry::get().getCallClobbers(MI) : 0);
+    }
+
     void doInit(MachineFunction &Fn) {
-      // iterate over all basic blocks, all instructions in a block,
-      // all operands in an instruction
+      regNums.init(TRI, Fn.getRegInfo());
+      operands.clear();
+      // iterate over all basic blocks and all instructions in a block;
+      // decoding an instruction's operands also numbers its regs
       int insNum = 1;
       for (MachineFunction::iterator MFIt = Fn.begin(), MFendIt = Fn.end();
 	   MFIt != MFendIt; MFIt++) {
@@ -302,451 +3307,479 @@ namespace {
 	  //*MBBIt is a MachineInstr
 	  InstrToNumMap[MBBIt] = insNum;
 	  insNum++;
-	  int numOp = MBBIt->getNumOperands();
-	  for (int i = 0; i < numOp; i++) {
-	    MachineOperand MOp = MBBIt->getOperand(i);  
-	    if (MOp.isReg() && MOp.getReg() && MOp.isDef()) {
-	      unsigned reg = MOp.getReg();
-	      // Here if this operand is
-	      //  (a) a register
-	      //  (b) not special reg 0
-	      //  (c) a def
-	      RDfactSet.insert(new RDfact(reg, MBBIt));
-	      // also add new reaching-defs facts for all aliases
-	      if (TargetRegisterInfo::isPhysicalRegister(reg)) {
-		const unsigned *aliasSet = TRI->getAliasSet(reg);
-		while (aliasSet != NULL && *aliasSet != 0) {
-		  RDfactSet.insert(new RDfact(*aliasSet, MBBIt));
-		  aliasSet++;
-		}
-	      } // end a preg, so deal with aliases
-	    } // end a def of a reg
-	  } // end for each operand
+	  decodeOperands(MBBIt);
 	} // end iterate over all instructions in 1 basic block
       } // end iterate over all basic blocks in this fn
+
+      // reg numbering is not complete until the scan above is done, so
+      // the RDfacts of the defs (and of their aliases) are interned now
+      RDfacts.clear(regNums.size());
+      operands.internDefs(RDfacts, regNums);
     } // end doInit
     
     
     //**********************************************************************
-    // doLiveAnalysis
-    //**********************************************************************
-    void doLiveAnalysis(MachineFunction &Fn) {
-      // initialize live maps to empty
-      liveBeforeMap.clear();
-      liveAfterMap.clear();
-      liveVarsGenMap.clear();
-      liveVarsKillMap.clear();
-      insLiveBeforeMap.clear();
-      insLiveAfterMap.clear();
-      
-      analyzeBasicBlocksLiveVars(Fn);
-      analyzeInstructionsLiveVars(Fn);
-    }
-    
-    //**********************************************************************
-    // doReachingDefsAnalysis
-    //**********************************************************************
-    void doReachingDefsAnalysis(MachineFunction &Fn) {
-      analyzeBasicBlocksRDefs(Fn);
-      analyzeInstructionsRDefs(Fn);
-    }
-    
-    //**********************************************************************
-    // analyzeBasicBlocksLiveVars
+    // splitWebs
     //
-    // iterate over all basic blocks bb
-    //    bb.gen = all upwards-exposed uses in bb
-    //    bb.kill = all defs in bb
-    //    put bb on the worklist
+    // the defs of a vreg that reach a common use, or that an instruction
+    // both reads and redefines (a two-address or partial def), belong to
+    // one web; join them with union-find over their RDfacts, and rename
+    // every web of a vreg but the first to a new vreg of the same class.
+    // A use that no def reaches keeps its vreg.  Return the number of
+    // new vregs.
     //**********************************************************************
-    void analyzeBasicBlocksLiveVars(MachineFunction &Fn) {
-      
-      // initialize all before/after/gen/kill sets and
-      // put all basic blocks on the worklist
-      set<MachineBasicBlock *> worklist;
-      for (MachineFunction::iterator MFIt = Fn.begin(), MFendIt = Fn.end();
-	   MFIt != MFendIt; MFIt++) {
-	liveBeforeMap[MFIt] = new set<unsigned>();
-	liveAfterMap[MFIt] = new set<unsigned>();
-	liveVarsGenMap[MFIt] = getUpwardsExposedUses(MFIt);
-	liveVarsKillMap[MFIt] = getAllDefs(MFIt);
-	worklist.insert(MFIt);
-      }
-      
-      // while the worklist is not empty {
-      //   remove one basic block bb
-      //   compute new bb.liveAfter = union of liveBefore's of all successors
-      //   replace old liveAfter with new one
-      //   compute new bb.liveBefore = (bb.liveAfter - bb.kill) union bb.gen
-      //   if bb.liveBefore changed {
-      //      replace old liveBefore with new one
-      //      add all of bb's predecessors to the worklist
-      //   }
-      // }
-      while (! worklist.empty()) {
-	// remove one basic block and compute its new liveAfter set
-	set<MachineBasicBlock *>::iterator oneBB = worklist.begin();
-	MachineBasicBlock *bb = *oneBB;
-	worklist.erase(bb);
-	
-	set<unsigned> *newLiveAfter = computeLiveAfter(bb);
-	
-	// update the liveAfter map
-	liveAfterMap.erase(bb);
-	liveAfterMap[bb] = newLiveAfter;
-	// compute its new liveBefore, see if it has changed (it can only
-	// get bigger)
-	set<unsigned> *newLiveBefore = computeLiveBefore(bb);
-	set<unsigned> *oldLiveBefore = liveBeforeMap[bb];
-	if (newLiveBefore->size() > oldLiveBefore->size()) {
-	  // update the liveBefore map and put all preds of bb on worklist
-	  liveBeforeMap.erase(bb);
-	  liveBeforeMap[bb] = newLiveBefore;
-	  for (MachineBasicBlock::pred_iterator PI = bb->pred_begin(),
-		 E = bb->pred_end();
-	       PI != E; PI++) {
-	    worklist.insert(*PI);
+    unsigned splitWebs(MachineFunction &Fn) {
+      MachineRegisterInfo &MRI = Fn.getRegInfo();
+      vector<unsigned> leader(RDfacts.size());
+      for (unsigned i = 0; i < leader.size(); i++)
+	leader[i] = i;
+
+      // join the defs reaching each read of a vreg, and the def of an
+      // instruction that also reads the vreg
+      for (MachineFunction::iterator bb = Fn.begin(), bbe = Fn.end();
+	   bb != bbe; bb++) {
+	for (MachineBasicBlock::iterator inIt = bb->begin(), ine = bb->end();
+	     inIt != ine; inIt++) {
+	  MachineInstr *MI = inIt;
+	  unsigned r = operands.getRecord(MI);
+	  for (unsigned i = 0; i < MI->getNumOperands(); i++) {
+	    MachineOperand &MOp = MI->getOperand(i);
+	    // a def of part of a vreg keeps the rest, so it reads it too
+	    if (!MOp.isReg() || !(MOp.isUse() || MOp.getSubReg()) ||
+		!TargetRegisterInfo::isVirtualRegister(MOp.getReg()))
+	      continue;
+	    unsigned idx = regNums.getIdx(MOp.getReg());
+	    int web = getReachingWeb(MI, idx, leader);
+	    if (web == -1)
+	      continue;
+	    const vector<unsigned> &facts = RDfacts.getFactsForReg(idx);
+	    const BitSet &RD = RDcache->getBefore(MI);
+	    for (unsigned f = 0; f < facts.size(); f++)
+	      if (RD.test(facts[f]))
+		leader[findWeb(leader, facts[f])] = web;
+	    for (OperandSummary::iterator d = operands.def_begin(r),
+		   e = operands.def_end(r); d != e; ++d)
+	      if (*d == idx)
+		leader[findWeb(leader, operands.getDefFact(d))] = web;
 	  }
 	}
       }
-    }
-    
-    //**********************************************************************
-    // analyzeBasicBlocksRDefs
-    //**********************************************************************
-    void analyzeBasicBlocksRDefs(MachineFunction &Fn) {
-      // iterate over all basic blocks bb computing
-      //    bb.gen = for each reg v defined in bb at inst: the RDfact
-      //             (v, inst)
-      //    bb.kill = all dataflow facts with reg v
-      // also put bb on the worklist
-      
-      set<MachineBasicBlock *> worklist;
-      for (MachineFunction::iterator MFIt = Fn.begin(), MFendIt = Fn.end();
-	   MFIt != MFendIt; MFIt++) {
-	RDbeforeMap[MFIt] = new set<RDfact *>();
-	RDafterMap[MFIt] = new set<RDfact *>();
-	RDgenMap[MFIt] = getRDgen(MFIt);
-	RDkillMap[MFIt] = getRDkill(MFIt);
-	worklist.insert(MFIt);
+
+      // the vreg of every web: the first web of a vreg keeps it
+      vector<unsigned> webReg(RDfacts.size(), 0);
+      vector<bool> isSplit(regNums.size(), false);
+      unsigned numNew = 0;
+      for (unsigned idx = 0; idx < regNums.size(); idx++) {
+	unsigned reg = regNums.getReg(idx);
+	if (!TargetRegisterInfo::isVirtualRegister(reg))
+	  continue;
+	const vector<unsigned> &facts = RDfacts.getFactsForReg(idx);
+	bool first = true;
+	for (unsigned f = 0; f < facts.size(); f++) {
+	  unsigned web = findWeb(leader, facts[f]);
+	  if (webReg[web])
+	    continue;
+	  if (first) {
+	    webReg[web] = reg;
+	    first = false;
+	  } else {
+	    webReg[web] = MRI.createVirtualRegister(MRI.getRegClass(reg));
+	    isSplit[idx] = true;
+	    numNew++;
+	    if (DEBUG_RD)
+	      errs() << "WEB " << reg << " -> " << webReg[web] << "\n";
+	  }
+	}
       }
-      
-      // while the worklist is not empty {
-      //   remove one basic block bb
-      //   compute new bb.RDbefore = union of RDafter's of all preds
-      //   replace old RDbefore with new one
-      //   compute new bb.RDafter = (bb.RDbefore - bb.RDkill) union
-      //                              bb.RDgen
-      //   if bb.RDafter changed {
-      //      replace old RDbefore with new one
-      //      add all of bb's succs to the worklist
-      //   }
-      // }
-      while (! worklist.empty()) {
-	// remove one basic block and compute its new RDbefore set
-	set<MachineBasicBlock *>::iterator oneBB = worklist.begin();
-	MachineBasicBlock *bb = *oneBB;
-	worklist.erase(bb);
-	
-	set<RDfact *> *newRDbefore = computeRDbefore(bb);
-	
-	// update the RDbefore map
-	RDbeforeMap.erase(bb);
-	RDbeforeMap[bb] = newRDbefore;
-	// compute its new RDafter, see if it has changed (it can only
-	// get bigger)
-	set<RDfact *> *newRDafter = computeRDafter(bb);
-	set<RDfact *> *oldRDafter = RDafterMap[bb];
-	if (newRDafter->size() > oldRDafter->size()) {
-	  // update the RDafter map and put all succs of bb on worklist
-	  RDafterMap.erase(bb);
-	  RDafterMap[bb] = newRDafter;
-	  for (MachineBasicBlock::succ_iterator PI = bb->succ_begin(),
-		 E = bb->succ_end();
-	       PI != E; PI++) {
-	    worklist.insert(*PI);
+      if (!numNew)
+	return 0;
+
+      // rename the operands of the vregs that were split
+      for (MachineFunction::iterator bb = Fn.begin(), bbe = Fn.end();
+	   bb != bbe; bb++) {
+	for (MachineBasicBlock::iterator inIt = bb->begin(), ine = bb->end();
+	     inIt != ine; inIt++) {
+	  MachineInstr *MI = inIt;
+	  for (unsigned i = 0; i < MI->getNumOperands(); i++) {
+	    MachineOperand &MOp = MI->getOperand(i);
+	    if (!MOp.isReg() ||
+		!TargetRegisterInfo::isVirtualRegister(MOp.getReg()))
+	      continue;
+	    unsigned reg = MOp.getReg();
+	    unsigned idx = regNums.getIdx(reg);
+	    if (idx == RegNumbering::NO_INDEX || !isSplit[idx])
+	      continue;
+	    int web = MOp.isDef()
+	      ? int(findWeb(leader, RDfacts.lookup(reg, MI)))
+	      : getReachingWeb(MI, idx, leader);
+	    if (web != -1)
+	      MOp.setReg(webReg[web]);
 	  }
 	}
       }
+      return numNew;
     }
-    
-    // **********************************************************************
-    // computeLiveBefore
-    //
-    // given: bb          ptr to a MachineBasicBlock 
-    //
-    // do:    compute and return bb's current LiveBefore set:
-    //          (bb.liveAfter - bb.kill) union bb.gen
-    // **********************************************************************
-    set<unsigned> *computeLiveBefore(MachineBasicBlock *bb) {
-      return regSetUnion(regSetSubtract(liveAfterMap[bb],
-					liveVarsKillMap[bb]
-					),
-			 liveVarsGenMap[bb]
-			 );
+
+    // the web of some def of the vreg with dense index idx that reaches
+    // MI, or -1 if none does
+    int getReachingWeb(MachineInstr *MI, unsigned idx,
+		       vector<unsigned> &leader) {
+      const vector<unsigned> &facts = RDfacts.getFactsForReg(idx);
+      const BitSet &RD = RDcache->getBefore(MI);
+      for (unsigned f = 0; f < facts.size(); f++)
+	if (RD.test(facts[f]))
+	  return findWeb(leader, facts[f]);
+      return -1;
     }
-    
-    
-    // **********************************************************************
-    // computeLiveAfter
-    //
-    // given: bb  ptr to a MachineBasicBlock 
-    //
-    // do:    compute and return bb's current LiveAfter set: the union
-    //        of the LiveBefore sets of all of bb's CFG successors
-    // **********************************************************************
-    set<unsigned> *computeLiveAfter(MachineBasicBlock *bb) {
-      set<unsigned> *result = new set<unsigned>();
-      for (MachineBasicBlock::succ_iterator SI = bb->succ_begin();
-	   SI != bb->succ_end(); SI++) {
-	MachineBasicBlock *oneSucc = *SI;
-	result = regSetUnion(result, liveBeforeMap[oneSucc]);
+
+    static unsigned findWeb(vector<unsigned> &leader, unsigned i) {
+      while (leader[i] != i) {
+	leader[i] = leader[leader[i]];
+	i = leader[i];
       }
-      
-      return result;
+      return i;
     }
-    
-    
-    // **********************************************************************
-    // computeRDbefore
-    //
-    // given: bb  ptr to a MachineBasicBlock 
+
+    //**********************************************************************
+    // findRematDefs
     //
-    // do:    compute and return bb's current RDbefore set: the union
-    //        of the RDafter sets of all of bb's CFG preds
-    // **********************************************************************
-    set<RDfact *> *computeRDbefore(MachineBasicBlock *bb) {
-      set<RDfact *> *result = new set<RDfact *>();
-      for (MachineBasicBlock::pred_iterator SI = bb->pred_begin();
-	   SI != bb->pred_end(); SI++) {
-	MachineBasicBlock *onePred = *SI;
-	result = RDsetUnion(result, RDafterMap[onePred]);
+    // fill in rematDefs: a vreg can be rematerialized if it has a single
+    // def, of the whole vreg, by an instruction the target says can be
+    // re-executed anywhere (a constant, a frame or global address, a
+    // constant-pool load) and that reads no vreg, since recomputing the
+    // value must not make any other vreg live longer
+    //**********************************************************************
+    void findRematDefs(MachineFunction &Fn) {
+      rematDefs.assign(regNums.size(), 0);
+      vector<unsigned> numDefs(regNums.size(), 0);
+      for (MachineFunction::iterator bb = Fn.begin(), bbe = Fn.end();
+	   bb != bbe; bb++) {
+	for (MachineBasicBlock::iterator inIt = bb->begin(), ine = bb->end();
+	     inIt != ine; inIt++) {
+	  MachineInstr *MI = inIt;
+	  unsigned r = operands.getRecord(MI);
+	  bool remat = TII->isTriviallyReMaterializable(MI);
+	  for (OperandSummary::iterator u = operands.use_begin(r),
+		 e = operands.use_end(r); remat && u != e; ++u)
+	    if (TargetRegisterInfo::isVirtualRegister(regNums.getReg(*u)))
+	      remat = false;
+	  for (unsigned i = 0; remat && i < MI->getNumOperands(); i++) {
+	    const MachineOperand &MOp = MI->getOperand(i);
+	    if (MOp.isReg() && MOp.isDef() && MOp.getSubReg())
+	      remat = false;
+	  }
+	  for (OperandSummary::iterator d = operands.def_begin(r),
+		 e = operands.def_end(r); d != e; ++d) {
+	    if (!TargetRegisterInfo::isVirtualRegister(regNums.getReg(*d)))
+	      continue;
+	    rematDefs[*d] = (++numDefs[*d] == 1 && remat) ? MI : 0;
+	  }
+	}
       }
-      
-      return result;
-    }
-    
-    // **********************************************************************
-    // computeRDafter
-    //
-    // given: bb          ptr to a MachineBasicBlock 
-    //
-    // do:    compute and return bb's current RDafter set:
-    //          (bb.RDbefore - bb.kill) union bb.gen
-    // **********************************************************************
-    set<RDfact *> *computeRDafter(MachineBasicBlock *bb) {
-      return RDsetUnion(RDsetSubtract(RDbeforeMap[bb],
-				      RDkillMap[bb]
-				      ),
-			RDgenMap[bb]
-			);
     }
-    
-    
-    
-    // **********************************************************************
-    // regSetUnion
+
+    //**********************************************************************
+    // computeSpillCosts
     //
-    // given: S1, S2          ptrs to sets of regs
-    // do:    return a ptr to (*S1 union *S2)
-    // **********************************************************************
-    set<unsigned> *regSetUnion(set<unsigned> *S1, set<unsigned> *S2) {
-      set<unsigned> *result = new set<unsigned>();
-      // iterate over S1
-      for (set<unsigned>::iterator oneRegPtr = S1->begin();
-	   oneRegPtr != S1->end();
-	   oneRegPtr++) {
-	result->insert(*oneRegPtr);
+    // fill in cost, indexed by dense reg index: for every vreg, the sum
+    // over its uses and defs of the loop weight of the enclosing block
+    // (Coloring divides this by the vreg's degree when it has to pick a
+    // spill candidate); spill temps get an infinite cost.  A vreg that
+    // can be rematerialized needs no store, and recomputing it is
+    // cheaper than a reload, so its uses count REMAT_WEIGHT each.
+    //**********************************************************************
+    void computeSpillCosts(MachineFunction &Fn, vector<float> &cost) {
+      static const float REMAT_WEIGHT = 0.5;
+      findRematDefs(Fn);
+      cost.assign(regNums.size(), 0);
+      for (MachineFunction::iterator bb = Fn.begin(), bbe = Fn.end();
+	   bb != bbe; bb++) {
+	float weight = getLoopWeight(loopInfo->getLoopDepth(bb));
+	for (MachineBasicBlock::iterator inIt = bb->begin(), ine = bb->end();
+	     inIt != ine; inIt++) {
+	  // a vreg costs one reload per using instruction and one store
+	  // per defining one, however many operands name it
+	  unsigned r = operands.getRecord(inIt);
+	  for (OperandSummary::iterator u = operands.use_begin(r),
+		 e = operands.use_end(r); u != e; ++u)
+	    if (TargetRegisterInfo::isVirtualRegister(regNums.getReg(*u)))
+	      cost[*u] += rematDefs[*u] ? weight * REMAT_WEIGHT : weight;
+	  for (OperandSummary::iterator d = operands.def_begin(r),
+		 e = operands.def_end(r); d != e; ++d)
+	    if (TargetRegisterInfo::isVirtualRegister(regNums.getReg(*d)) &&
+		!rematDefs[*d])
+	      cost[*d] += weight;
+	}
       }
-      
-      // iterate over S2
-      for (set<unsigned>::iterator oneRegPtr = S2->begin();
-	   oneRegPtr != S2->end();
-	   oneRegPtr++) {
-	result->insert(*oneRegPtr);
+      for (set<unsigned>::iterator IT = spillTemps.begin();
+	   IT != spillTemps.end(); IT++) {
+	unsigned idx = regNums.getIdx(*IT);
+	if (idx != RegNumbering::NO_INDEX)
+	  cost[idx] = numeric_limits<float>::infinity();
       }
-      
-      return result;
     }
-    
-    // **********************************************************************
-    // RDsetUnion
+
+    //**********************************************************************
+    // spillReg
     //
-    // given: S1, S2          ptrs to sets of ptrs to RDfacts
-    // do:    return a ptr to (*S1 union *S2)
-    // **********************************************************************
-    set<RDfact *> *RDsetUnion(set<RDfact *> *S1, set<RDfact *> *S2) {
-      set<RDfact *> *result = new set<RDfact *>();
-      // iterate over S1
-      for (set<RDfact *>::iterator oneRDfact = S1->begin();
-	   oneRDfact != S1->end();
-	   oneRDfact++) {
-	result->insert(*oneRDfact);
+    // give vreg reg a stack slot and replace it by a new short-lived
+    // vreg (a spill temp) at every instruction that uses or defines it:
+    // the temp is loaded from the slot just before a use and stored to
+    // the slot just after a def
+    //**********************************************************************
+    void spillReg(MachineFunction &Fn, unsigned reg) {
+      MachineRegisterInfo &MRI = Fn.getRegInfo();
+      const TargetRegisterClass *RC = MRI.getRegClass(reg);
+      int slot = Fn.getFrameInfo()->CreateSpillStackObject(RC->getSize(),
+							   RC->getAlignment());
+      if (DEBUG_SPILL)
+	errs() << "SPILL " << reg << " to stack slot " << slot << "\n";
+
+      for (MachineFunction::iterator bb = Fn.begin(), bbe = Fn.end();
+	   bb != bbe; bb++) {
+	for (MachineBasicBlock::iterator inIt = bb->begin();
+	     inIt != bb->end(); inIt++)
+	  spillInstr(*bb, inIt, reg, slot);
+      } // end iterate over blocks
+    }
+
+    // if the instruction at inIt uses or defines reg, replace reg there
+    // by a new spill temp, reloaded from slot before it if it reads reg
+    // and stored to slot after it if it writes reg; inIt is left at the
+    // last instruction inserted or changed
+    void spillInstr(MachineBasicBlock &bb, MachineBasicBlock::iterator &inIt,
+		    unsigned reg, int slot) {
+      MachineRegisterInfo &MRI = bb.getParent()->getRegInfo();
+      const TargetRegisterClass *RC = MRI.getRegClass(reg);
+      MachineInstr *MI = inIt;
+      bool isUse = false, isDef = false;
+      unsigned numOp = MI->getNumOperands();
+      for (unsigned i = 0; i < numOp; i++) {
+	MachineOperand &MOp = MI->getOperand(i);
+	if (!MOp.isReg() || MOp.getReg() != reg)
+	  continue;
+	// a def of part of reg keeps the rest, so it reads reg too
+	if (MOp.isUse() || MOp.getSubReg())
+	  isUse = true;
+	if (MOp.isDef())
+	  isDef = true;
       }
-      
-      // iterate over S2
-      for (set<RDfact *>::iterator oneRDfact = S2->begin();
-	   oneRDfact != S2->end();
-	   oneRDfact++) {
-	result->insert(*oneRDfact);
+      if (!isUse && !isDef)
+	return;
+
+      unsigned temp = MRI.createVirtualRegister(RC);
+      spillTemps.insert(temp);
+      for (unsigned i = 0; i < numOp; i++) {
+	MachineOperand &MOp = MI->getOperand(i);
+	if (MOp.isReg() && MOp.getReg() == reg)
+	  MOp.setReg(temp);
       }
-      
-      return result;
-    }
-    
-    
-    // **********************************************************************
-    // regSetSubtract
-    //
-    // given: S1, S2          ptrs to sets of regs
-    // do:    return a ptr to (*S1 - *S2)
-    //
-    // **********************************************************************
-    set<unsigned> *regSetSubtract(set<unsigned> *S1, set<unsigned> *S2) {
-      set<unsigned> *result = new set<unsigned>();
-      // iterate over S1; for each element, if it is NOT in S2, then
-      // add it to the result
-      for (set<unsigned>::iterator S1RegPtr = S1->begin();
-	   S1RegPtr != S1->end();
-	   S1RegPtr++) {
-	if (S2->count(*S1RegPtr) == 0) {
-	  result->insert(*S1RegPtr);
-	}
+      SpillTemp T = { temp, MI, isUse, isDef, 0, 0 };
+      if (isUse) {
+	TII->loadRegFromStackSlot(bb, MI, temp, slot, RC);
+	MachineBasicBlock::iterator load(MI);
+	T.load = --load;
       }
-      
-      return result;
-    }
-    
-    // **********************************************************************
-    // RDsetSubtract
-    //
-    // given: S1, S2          ptrs to sets of RDfact ptrs
-    // do:    return a ptr to (*S1 - *S2)
-    //
-    // **********************************************************************
-    set<RDfact *> *RDsetSubtract(set<RDfact *> *S1, set<RDfact *> *S2) {
-      set<RDfact *> *result = new set<RDfact *>();
-      // iterate over S1; for each element, if it is NOT in S2, then
-      // add it to the result
-      for (set<RDfact *>::iterator S1RegPtr = S1->begin();
-	   S1RegPtr != S1->end();
-	   S1RegPtr++) {
-	if (S2->count(*S1RegPtr) == 0) {
-	  result->insert(*S1RegPtr);
-	}
+      if (isDef) {
+	MachineBasicBlock::iterator nextI(MI);
+	++nextI;
+	TII->storeRegToStackSlot(bb, nextI, temp, true, slot, RC);
+	// skip the store we just inserted
+	inIt = nextI;
+	--inIt;
+	T.store = inIt;
       }
-      
-      return result;
+      if (spillLog)
+	spillLog->push_back(T);
     }
 
     //**********************************************************************
-    // analyzeInstructionsLiveVars
+    // rematerializeReg
     //
-    // do live-var analysis at the instruction level:
-    //   iterate over all basic blocks
-    //   for each, iterate backwards over instructions, propagating
-    //             live-var info:
-    //     for each instruction inst
-    //             live-before = (live-after - kill) union gen
-    //     where kill is the defined reg of inst (if any) and
-    //           gen is all reg-use operands of inst
+    // the spillReg of a vreg with a rematerializable def: every
+    // instruction that uses reg gets a new spill temp, defined by a copy
+    // of def inserted just before it, and def itself is deleted
     //**********************************************************************
-    void analyzeInstructionsLiveVars(MachineFunction &Fn) {
-      for (MachineFunction::iterator bb = Fn.begin(), bbe = Fn.end(); 
+    void rematerializeReg(MachineFunction &Fn, unsigned reg,
+			  MachineInstr *def) {
+      MachineRegisterInfo &MRI = Fn.getRegInfo();
+      const TargetRegisterClass *RC = MRI.getRegClass(reg);
+      if (DEBUG_SPILL)
+	errs() << "REMAT " << reg << "\n";
+
+      for (MachineFunction::iterator bb = Fn.begin(), bbe = Fn.end();
 	   bb != bbe; bb++) {
-	// no reverse iterator and recursion doesn't work,
-	// so create vector of instructions for backward traversal
-	vector<MachineInstr *> instVector;
 	for (MachineBasicBlock::iterator inIt = bb->begin();
-	     inIt != bb->end();
-	     inIt++) {
-	  instVector.push_back(inIt);
+	     inIt != bb->end(); inIt++) {
+	  MachineInstr *MI = inIt;
+	  if (MI == def)
+	    continue;
+	  bool isUse = false;
+	  unsigned numOp = MI->getNumOperands();
+	  for (unsigned i = 0; i < numOp; i++) {
+	    MachineOperand &MOp = MI->getOperand(i);
+	    if (MOp.isReg() && MOp.getReg() == reg)
+	      isUse = true;
+	  }
+	  if (!isUse)
+	    continue;
+
+	  unsigned temp = MRI.createVirtualRegister(RC);
+	  spillTemps.insert(temp);
+	  for (unsigned i = 0; i < numOp; i++) {
+	    MachineOperand &MOp = MI->getOperand(i);
+	    if (MOp.isReg() && MOp.getReg() == reg)
+	      MOp.setReg(temp);
+	  }
+	  TII->reMaterialize(*bb, MI, temp, 0, def, TRI);
+	  if (spillLog) {
+	    MachineBasicBlock::iterator load(MI);
+	    SpillTemp T = { temp, MI, true, false, --load, 0 };
+	    spillLog->push_back(T);
+	  }
+	} // end iterate over instructions
+      } // end iterate over blocks
+      operands.remove(def);
+      def->eraseFromParent();
+    }
+
+    //**********************************************************************
+    // rewriteRegisters
+    //
+    // replace every vreg operand by the physical register it was given,
+    // then delete the copies that became no-ops
+    //**********************************************************************
+    void rewriteRegisters(MachineFunction &Fn, const vector<unsigned> &color) {
+      for (MachineFunction::iterator bb = Fn.begin(), bbe = Fn.end();
+	   bb != bbe; bb++)
+	rewriteBlock(*bb, color);
+    }
+
+    // rewriteRegisters for the instructions of one block
+    void rewriteBlock(MachineBasicBlock &bb, const vector<unsigned> &color) {
+      MachineRegisterInfo &MRI = bb.getParent()->getRegInfo();
+      for (MachineBasicBlock::iterator inIt = bb.begin(); inIt != bb.end(); ) {
+	MachineInstr *MI = inIt;
+	++inIt;
+	unsigned numOp = MI->getNumOperands();
+	for (unsigned i = 0; i < numOp; i++) {
+	  MachineOperand &MOp = MI->getOperand(i);
+	  if (!MOp.isReg() || !MOp.getReg() ||
+	      !TargetRegisterInfo::isVirtualRegister(MOp.getReg()))
+	    continue;
+	  unsigned phys = color[regNums.getIdx(MOp.getReg())];
+	  // an operand that names part of the vreg gets the same part of
+	  // the physical register
+	  if (MOp.getSubReg()) {
+	    phys = TRI->getSubReg(phys, MOp.getSubReg());
+	    MOp.setSubReg(0);
+	  }
+	  MOp.setReg(phys);
+	  MRI.setPhysRegUsed(phys);
 	}
-	
-	liveForInstr(instVector, liveAfterMap[bb]);
-      }
+	unsigned src, dst, srcSub, dstSub;
+	if (TII->isMoveInstr(*MI, src, dst, srcSub, dstSub) && src == dst &&
+	    srcSub == dstSub)
+	  MI->eraseFromParent();
+      } // end iterate over instructions
     }
-    
+
     //**********************************************************************
-    // analyzeInstructionsRDefs
+    // doLiveAnalysis
     //
-    // given reaching-defs before and after facts for basic block,
-    // compute before/after facts for each instruction in each basic block
+    // solve live variables for the blocks, then refine each block to
+    // get the sets before and after every instruction; return the
+    // number of block visits the solver made
+    //**********************************************************************
+    unsigned doLiveAnalysis(MachineFunction &Fn) {
+      MachineGraph graph(Fn);
+      DataFlow<MachineGraph, LiveVarsProblem> live(graph, liveProblem, arena);
+      live.solve();
+      NumDFVisits += live.getNumPops();
+      if (DEBUG_SOLVE)
+	errs() << "LIVE VARS: " << live.getNumPops() << " block visits in "
+	       << live.getNumPasses() << " passes\n";
+
+      liveBeforeMap.swap(live.getBeforeSets());
+      liveAfterMap.swap(live.getAfterSets());
+      liveVarsGenMap.swap(live.getGenSets());
+      liveVarsKillMap.swap(live.getKillSets());
+      liveCache = new InstrSetCache<MachineGraph, LiveVarsProblem>(graph,
+	  liveProblem, liveAfterMap, arena);
+      return live.getNumPops();
+    }
+
+    //**********************************************************************
+    // doReachingDefsAnalysis
     //
-    // for one instruction: RDafter = (RDbefore - kill) union gen
-    // where kill is all dataflow facts with the regs that are defined
-    // by this instruction (if any), and gen is the set of facts (reg, inst)
-    // for all regs defined by this instruction (if any)
+    // solve reaching defs for the blocks, then refine each block to get
+    // the sets before and after every instruction; return the number of
+    // block visits the solver made
     //**********************************************************************
-    void analyzeInstructionsRDefs(MachineFunction &Fn) {
-      // iterate over all basic blocks in this function
-      for (MachineFunction::iterator bb = Fn.begin(), bbe = Fn.end(); 
-	   bb != bbe; bb++) {
-	set<RDfact *> *RDbefore = RDbeforeMap[bb];
-	// iterate over all instructions in this basic block
-	for (MachineBasicBlock::iterator inIt = bb->begin();
-	     inIt != bb->end();
-	     inIt++) {
-	  insRDbeforeMap[inIt] = RDbefore;
-	  set<RDfact *> *kill = new set<RDfact *>();
-	  set<RDfact *> *gen = new set<RDfact *>();
-	  set<unsigned> *regDefs = getOneInstrRegDefs(inIt);
-	  // if at least one reg was defined
-	  // then compute gen and kill sets for this instruction
-	  if (regDefs->size() > 0) {
-	    for (set<unsigned>::iterator regIt = regDefs->begin();
-		 regIt != regDefs->end(); regIt++) {
-	      unsigned oneDef = *regIt;
-	      gen->insert(new RDfact(oneDef, inIt));
-	      // iterate over all RDfacts, see which are killed
-	      for (set<RDfact *>::iterator IT = RDfactSet.begin();
-		   IT != RDfactSet.end(); IT++) {
-		RDfact *oneRDfact = *IT;
-		unsigned oneReg = oneRDfact->getReg();
-		if (oneReg == oneDef) {
-		  kill->insert(oneRDfact);
-		}
-	      } // end iterate over all RDfacts to compute kill
-	    } // end iterate over set of regs defined by one instruction
-
-	    // we've now defined the gen and kill sets so we can
-	    // compute the "after" fact for this instruction
-	    set<RDfact *> *RDafter = RDsetUnion(RDsetSubtract(RDbefore, kill),
-						gen);
-	    insRDafterMap[inIt] = RDafter;
-	    RDbefore = RDafter;
-	  } else {
-	    // this instruction doesn't define any reg
-	    insRDafterMap[inIt] = RDbefore;
-	  }
-	} // end iterate over all instructions in 1 basic block
-      } // end iterate over all basic blocks
+    unsigned doReachingDefsAnalysis(MachineFunction &Fn) {
+      MachineGraph graph(Fn);
+      DataFlow<MachineGraph, RDefsProblem> RD(graph, RDproblem, arena);
+      RD.solve();
+      NumDFVisits += RD.getNumPops();
+      if (DEBUG_SOLVE)
+	errs() << "REACHING DEFS: " << RD.getNumPops() << " block visits in "
+	       << RD.getNumPasses() << " passes\n";
+
+      RDbeforeMap.swap(RD.getBeforeSets());
+      RDafterMap.swap(RD.getAfterSets());
+      RDgenMap.swap(RD.getGenSets());
+      RDkillMap.swap(RD.getKillSets());
+      RDcache = new InstrSetCache<MachineGraph, RDefsProblem>(graph,
+	  RDproblem, RDbeforeMap, arena);
+      return RD.getNumPops();
     }
-    
+
+    // **********************************************************************
+    // genKillRDfacts
+    //
+    // given: instruct  ptr to an instruction
+    //        RD        set of RDfact IDs
+    // do:    RD = (RD - kill) union gen for this instruction, where the
+    //        regs it defines include aliases
+    // **********************************************************************
+    void genKillRDfacts(MachineInstr *instruct, BitSet &RD) {
+      unsigned r = operands.getRecord(instruct);
+      OperandSummary::iterator d, e = operands.def_end(r);
+      for (d = operands.def_begin(r); d != e; ++d)
+	killRDfacts(*d, RD);
+      for (d = operands.def_begin(r); d != e; ++d)
+	RD.set(operands.getDefFact(d));
+    }
+
+    // remove every fact for the reg with dense index idx from RD
+    // (through the reg's kill list)
+    void killRDfacts(unsigned idx, BitSet &RD) {
+      const vector<unsigned> &killed = RDfacts.getFactsForReg(idx);
+      for (unsigned i = 0; i < killed.size(); i++)
+	RD.reset(killed[i]);
+    }
+
     // **********************************************************************
     // getUpwardsExposedUses
     //
     // given: bb      ptr to a basic block
-    // do:    return a ptr to the set of regs that are used before
+    //        result  empty set over all regs of the function
+    // do:    fill in result with the regs that are used before
     //        being defined in bb; include aliases!
     // **********************************************************************
-    set<unsigned> *getUpwardsExposedUses(MachineBasicBlock *bb) {
-      set<unsigned> *result = new set<unsigned>();
-      set<unsigned> *defs = new set<unsigned>();
+    void getUpwardsExposedUses(MachineBasicBlock *bb, BitSet &result) {
+      BitSet defs(regNums.size(), arena);
       for (MachineBasicBlock::iterator instruct = bb->begin(),
 	     instructEnd = bb->end(); instruct != instructEnd; instruct++) {
-	set<unsigned> *uses = getOneInstrRegUses(instruct);
-	set<unsigned> *upUses = regSetSubtract(uses, defs);
-	result = regSetUnion(result, upUses);
-	set<unsigned> *defSet = getOneInstrRegDefs(instruct);
-	for (set<unsigned>::iterator IT = defSet->begin();
-	     IT != defSet->end(); IT++) {
-	  unsigned oneDef = *IT;
-	  defs->insert(oneDef);
-	}
+	unsigned r = operands.getRecord(instruct);
+	for (OperandSummary::iterator u = operands.use_begin(r),
+	       e = operands.use_end(r); u != e; ++u)
+	  if (!defs.test(*u))
+	    result.set(*u);
+	for (OperandSummary::iterator d = operands.def_begin(r),
+	       e = operands.def_end(r); d != e; ++d)
+	  defs.set(*d);
       } // end iterate over all instrutions in this basic block
-      
-      return result;
     }
     
     
@@ -754,175 +3787,55 @@ namespace {
     // getRDgen
     //
     // given: bb      ptr to a basic block
-    // do:    return a set of reaching-def facts: the ones that occur in bb
+    //        result  empty set over all RDfact IDs
+    // do:    fill in result with the reaching-def facts that occur in bb
+    //        and reach its end
     // **********************************************************************
-    set<RDfact *> *getRDgen(MachineBasicBlock *bb) {
-      set<RDfact *> *result = new set<RDfact *>();
+    void getRDgen(MachineBasicBlock *bb, BitSet &result) {
       for (MachineBasicBlock::iterator instruct = bb->begin(),
 	     instructEnd = bb->end(); instruct != instructEnd; instruct++) {
-	set<unsigned> *defSet = getOneInstrRegDefs(instruct);
-	for (set<unsigned>::iterator IT = defSet->begin();
-	     IT != defSet->end(); IT++) {
-	  unsigned oneDef = *IT;
-	  result->insert(new RDfact(oneDef, instruct));
-	}
+	genKillRDfacts(instruct, result);
       } // end iterate over all instructions in this basic block
-      
-      return result;
     }
     
     // **********************************************************************
     // getRDkill
     //
     // given: bb      ptr to a basic block
-    // do:    return a set of reaching-def facts: the ones whose reg
+    //        result  empty set over all RDfact IDs
+    // do:    fill in result with the reaching-def facts whose reg
     //        component is defined in bb
     // **********************************************************************
-    set<RDfact *> *getRDkill(MachineBasicBlock *bb) {
-      set<RDfact *> *result = new set<RDfact *>();
+    void getRDkill(MachineBasicBlock *bb, BitSet &result) {
       for (MachineBasicBlock::iterator instruct = bb->begin(),
 	     instructEnd = bb->end(); instruct != instructEnd; instruct++) {
-	set<unsigned> *defSet = getOneInstrRegDefs(instruct);
-	for (set<unsigned>::iterator IT = defSet->begin();
-	     IT != defSet->end(); IT++) {
-	  unsigned oneDef = *IT;
-	  for (set<RDfact *>::iterator IT = RDfactSet.begin();
-	       IT != RDfactSet.end(); IT++) {
-	    RDfact *oneRDfact = *IT;
-	    unsigned oneReg = oneRDfact->getReg();
-	    if (oneReg == oneDef) {
-	      result->insert(oneRDfact);
-	    }
-	  } // end iterate over all RDfacts in the whole fn
+	unsigned r = operands.getRecord(instruct);
+	for (OperandSummary::iterator d = operands.def_begin(r),
+	       e = operands.def_end(r); d != e; ++d) {
+	  // the reg's kill list holds exactly the facts to kill
+	  const vector<unsigned> &killed = RDfacts.getFactsForReg(*d);
+	  for (unsigned i = 0; i < killed.size(); i++)
+	    result.set(killed[i]);
 	} // end iterate over all defs in this instruction
       } // end iterate over all instructions in this basic block
-      
-      return result;
-    }
-    
-    //**********************************************************************
-    // getOneInstrRegUses
-    //
-    // return the set of registers (virtual or physical) used by the
-    // given instruction, including aliases of any physical registers
-    //**********************************************************************
-    set<unsigned> *getOneInstrRegUses(MachineInstr *instruct) {
-      set<unsigned> *result = new set<unsigned>();
-      unsigned numOperands = instruct->getNumOperands();
-      for (unsigned n=0; n<numOperands; n++) {
-	MachineOperand MOp = instruct->getOperand(n);
-	if (MOp.isReg() && MOp.getReg() && MOp.isUse()) {
-	  unsigned reg = MOp.getReg();
-	  if (TargetRegisterInfo::isPhysicalRegister(reg)) {
-	    addAliases(result, reg);
-	  }
-	  result->insert(reg);
-	}
-      } // end for each operand of current instruction
-      return result;
-    }
-    
-    //**********************************************************************
-    // getOneInstrRegDefs
-    //
-    // return a ptr to a set of the registers defined by this instruction
-    // including aliases
-    //**********************************************************************
-    set<unsigned> *getOneInstrRegDefs(MachineInstr *instruct) {
-      set<unsigned> *result = new set<unsigned>();
-      unsigned numOperands = instruct->getNumOperands();
-      for (unsigned n=0; n<numOperands; n++) {
-	MachineOperand MOp = instruct->getOperand(n);
-	if (MOp.isReg() && MOp.getReg() && MOp.isDef()) {
-	  unsigned reg = MOp.getReg();
-	  addAliases(result, reg);
-	  result->insert(reg);
-	}
-      } // end for each operand of current instruction
-      return result;
     }
     
     // **********************************************************************
     // getAllDefs
     //
     // given: bb      ptr to a basic block
-    // do:    return the set of regs that are defined in bb
+    //        result  empty set over all regs of the function
+    // do:    fill in result with the regs that are defined in bb,
+    //        including aliases (as the instruction-level kill sets do)
     // **********************************************************************
-    set<unsigned> *getAllDefs(MachineBasicBlock *bb) {
-      set<unsigned> *result = new set<unsigned>();
-      
-      // iterate over all instructions in bb
-      //   for each operand that is a non-zero reg:
-      //     if it is a def then add it to the result set
-      // return result
-      // 
+    void getAllDefs(MachineBasicBlock *bb, BitSet &result) {
       for (MachineBasicBlock::iterator instruct = bb->begin(),
 	     instructEnd = bb->end(); instruct != instructEnd; instruct++) {
-	unsigned numOperands = instruct->getNumOperands();
-	for (unsigned n=0; n<numOperands; n++) {
-	  MachineOperand MOp = instruct->getOperand(n);
-	  if (MOp.isReg() && MOp.getReg() && MOp.isDef()) {
-	    result->insert(MOp.getReg());
-	  }
-	} // end for each operand of current instruction
+	unsigned r = operands.getRecord(instruct);
+	for (OperandSummary::iterator d = operands.def_begin(r),
+	       e = operands.def_end(r); d != e; ++d)
+	  result.set(*d);
       } // end iterate over all instrutions in this basic block
-      return result;
-    }
-    
-    // **********************************************************************
-    // liveForInstr
-    //
-    // given: instVector vector of ptrs to Instructions for one basic block
-    //        liveAfter  live after set for the *last* instruction in the block
-    //
-    // do:    compute and set liveAfter and liveBefore for each instruction
-    //        liveAfter = liveBefore of next instruction
-    //        liveBefore = (liveAfter - kill) union gen
-    // **********************************************************************
-    void liveForInstr(vector<MachineInstr *>instVector,
-		      set<unsigned> *liveAfter) {
-      while (instVector.size() > 0) {
-	MachineInstr *oneInstr = instVector.back();
-	instVector.pop_back();
-	insLiveAfterMap[oneInstr] = liveAfter;
-	
-	// create liveBefore for this instruction
-	// (which is also liveAfter for the previous one in the block)
-	//   remove the reg defined here (if any) from the set
-	//   then add all used reg operands
-	
-	set<unsigned> *liveBefore;
-	set<unsigned> *gen = getOneInstrRegUses(oneInstr);
-	set<unsigned> *kill = getOneInstrRegDefs(oneInstr);
-	if (kill->size() != 0) {
-	  liveBefore = regSetUnion(regSetSubtract(liveAfter, kill), gen);
-	} else {
-	  liveBefore = regSetUnion(liveAfter, gen);
-	}
-	
-	// add this instruction's liveBefore set to the map
-	// and prepare for the next iteration of the loop
-	insLiveBeforeMap[oneInstr] = liveBefore;
-	liveAfter = liveBefore;
-      } // end while
-    }
-    
-    //**********************************************************************
-    // addAliases
-    //
-    // given: ptr to set of registers
-    //        one reg
-    //
-    // do: add all aliases of reg to set (only a preg has aliases)
-    //**********************************************************************
-    void addAliases(set<unsigned> *S, unsigned reg) {
-      if (TargetRegisterInfo::isPhysicalRegister(reg)) {
-	const unsigned *aliasSet = TRI->getAliasSet(reg);
-	while (aliasSet != NULL && *aliasSet != 0) {
-	  S->insert(*aliasSet);
-	  aliasSet++;
-	}
-      }      
     }
     
     // **********************************************************************
@@ -964,9 +3877,9 @@ namespace {
 	errs() << "BASIC BLOCK #" << bb->getNumber();
 	// print live before and after sets
 	errs() << "  L-Before: ";
-	printRegSet(liveBeforeMap[bb]);
+	printRegSet(liveBeforeMap[bb->getNumber()]);
 	errs() << "  L-After: ";
-	printRegSet(liveAfterMap[bb]);
+	printRegSet(liveAfterMap[bb->getNumber()]);
 	errs() << "\n";
 	
 	// iterate over instructions, printing each live set
@@ -975,9 +3888,9 @@ namespace {
 	     inIt != ine; inIt++) {
 	  errs() << "%" << InstrToNumMap[inIt] << ": ";
 	  errs() << " L-Before: ";
-	  printRegSet(insLiveBeforeMap[inIt]);
+	  printRegSet(liveCache->getBefore(inIt));
 	  errs() << "\tL-After: ";
-	  printRegSet(insLiveAfterMap[inIt]);
+	  printRegSet(liveCache->getAfter(inIt));
 	  errs() << "\n";
 	}
       }
@@ -1004,9 +3917,9 @@ namespace {
 	errs() << "BASIC BLOCK #" << bb->getNumber();
 	// print RD before and after sets
 	errs() << "  RD-Before: ";
-	printRDSet(RDbeforeMap[bb]);
+	printRDSet(RDbeforeMap[bb->getNumber()]);
 	errs() << "  RD-After: ";
-	printRDSet(RDafterMap[bb]);
+	printRDSet(RDafterMap[bb->getNumber()]);
 	errs() << "\n";
 	
 	// iterate over instructions, printing each RD set
@@ -1015,9 +3928,9 @@ namespace {
 	     inIt != ine; inIt++) {
 	  errs() << "%" << InstrToNumMap[inIt] << ": ";
 	  errs() << " RD-Before: ";
-	  printRDSet(insRDbeforeMap[inIt]);
+	  printRDSet(RDcache->getBefore(inIt));
 	  errs() << "\nRD-After: ";
-	  printRDSet(insRDafterMap[inIt]);
+	  printRDSet(RDcache->getAfter(inIt));
 	  errs() << "\n";
 	}
       }
@@ -1026,110 +3939,34 @@ namespace {
     // **********************************************************************
     // printRegSet
     //
-    // given: S      ptr to set of regs (unsigned)
-    // do:    print the set
-    // ********************************************************************
-    void printRegSet(set<unsigned> *S) {
-      errs() << "{";
-      for (set<unsigned>::iterator IT = S->begin(); IT != S->end(); IT++) {
-	unsigned reg = *IT;
-	errs() << " " << reg;
-      }
-      errs() << " }\n";
-    }
-      
-    // **********************************************************************
-    // printRegSetWithAliases
-    //
-    // given: S      ptr to set of regs (unsigned)
-    // do:    print the set
+    // given: S      set of dense reg indexes
+    // do:    print the set as the regs the indexes stand for
     // ********************************************************************
-    void printRegSetWithAliases(set<unsigned> *S) {
+    void printRegSet(const BitSet &S) {
       errs() << "{";
-      const unsigned *aliasSet;
-      set<unsigned> aliases;
-      for (set<unsigned>::iterator IT = S->begin(); IT != S->end(); IT++) {
-	unsigned reg = *IT;
-	errs() << " " << reg;
-	if (TargetRegisterInfo::isPhysicalRegister(reg)) {
-	  aliasSet = TRI->getAliasSet(reg);      
-	  while (aliasSet != NULL && *aliasSet != 0) {
-	    aliases.insert(*aliasSet);
-	    aliasSet++;
-	  }
-	}
+      for (int idx = S.findFirst(); idx != -1; idx = S.findNext(idx)) {
+	errs() << " " << regNums.getReg(idx);
       }
       errs() << " }\n";
-      errs() << "ALIASES: {";
-      for(set<unsigned>::iterator IT = aliases.begin(); IT != aliases.end();
-	  IT++) {
-	errs() << " " << *IT;
-      }
-      errs() << "}\n";
     }
       
     // **********************************************************************
     // printRDSet
     //
-    // given: S      ptr to set of RDfact
+    // given: S      set of RDfact IDs
     // do:    print the set
     // **********************************************************************
-    void printRDSet(set<RDfact *> *S) {
+    void printRDSet(const BitSet &S) {
       errs() << "{";
-      for (set<RDfact *>::iterator IT = S->begin(); IT != S->end(); IT++) {
-	RDfact *oneRDfact = *IT;
-	MachineInstr *oneIns = oneRDfact->getInstr();
-	errs() << "(" << oneRDfact->getReg() << ", %"
+      for (int id = S.findFirst(); id != -1; id = S.findNext(id)) {
+	RDfact &oneRDfact = RDfacts.getFact(id);
+	MachineInstr *oneIns = oneRDfact.getInstr();
+	errs() << "(" << oneRDfact.getReg() << ", %"
 	     << InstrToNumMap[oneIns] << ") ";
       }
       errs() << " }";
     }
     
-    //**********************************************************************
-    // getDefReg
-    //
-    // given: instr  ptr to MachineInstr
-    // do:    return the reg defined there
-    //**********************************************************************
-    unsigned getDefReg(MachineInstr *instr) {
-      int numOp = instr->getNumOperands();
-      for (int i = 0; i < numOp; i++) {
-	MachineOperand MOp = instr->getOperand(i);  
-	if (MOp.isReg() && MOp.getReg() 
-	    && MOp.isDef()) {
-	  return MOp.getReg();
-	}
-      }
-      errs() << "INTERNAL ERROR: NO DEFINED REG IN getDefReg\n";
-      exit(1);
-    }
-    
-    //**********************************************************************
-    // member
-    // given: oneFact  ptr to an RDfact
-    //        S        ptr to set of RDfact *
-    //
-    // do:    return true iff oneFact is in S
-    //**********************************************************************
-    bool member(RDfact *oneFact, set<RDfact *> *S) {
-      for (set<RDfact *>::iterator IT = S->begin(); IT != S->end(); IT++) {
-	RDfact *curr = *IT;
-	if ((curr->getReg() == oneFact->getReg()) &&
-	    (curr->getInstr() == oneFact->getInstr())) return true;
-      }
-      return false;
-    }
-    
-    //**********************************************************************
-    // printRegSet
-    //**********************************************************************
-    void printRegSet(set<unsigned> S) {
-      for (set<unsigned>::iterator IT = S.begin(); IT != S.end(); IT++) {
-	unsigned reg = *IT;
-	errs() << reg << " ";
-      }
-    }
-    
   };
   
   // The library-inclusion mechanism requires the following runes:
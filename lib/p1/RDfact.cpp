@@ -21,3 +21,59 @@ unsigned RDfact::getReg() {
 MachineInstr *RDfact::getInstr() {
   return myInstr;
 }
+
+//**********************************************************************
+// RDfactTable::clear
+//**********************************************************************
+void RDfactTable::clear(unsigned numRegs) {
+  facts.clear();
+  factIds.clear();
+  regToFacts.clear();
+  regToFacts.resize(numRegs);
+}
+
+//**********************************************************************
+// RDfactTable::intern
+//**********************************************************************
+unsigned RDfactTable::intern(unsigned reg, unsigned regIdx,
+                             MachineInstr *inst) {
+  std::pair<std::map<std::pair<unsigned, MachineInstr *>, unsigned>::iterator,
+            bool> res =
+    factIds.insert(std::make_pair(std::make_pair(reg, inst), facts.size()));
+  if (res.second) {
+    facts.push_back(RDfact(reg, inst));
+    regToFacts[regIdx].push_back(res.first->second);
+  }
+  return res.first->second;
+}
+
+//**********************************************************************
+// RDfactTable::lookup
+//**********************************************************************
+unsigned RDfactTable::lookup(unsigned reg, MachineInstr *inst) const {
+  std::map<std::pair<unsigned, MachineInstr *>, unsigned>::const_iterator IT =
+    factIds.find(std::make_pair(reg, inst));
+  assert(IT != factIds.end() && "RDfact was not interned");
+  return IT->second;
+}
+
+//**********************************************************************
+// RDfactTable::getFact
+//**********************************************************************
+RDfact &RDfactTable::getFact(unsigned id) {
+  return facts[id];
+}
+
+//**********************************************************************
+// RDfactTable::getFactsForReg
+//**********************************************************************
+const std::vector<unsigned> &RDfactTable::getFactsForReg(unsigned regIdx) const {
+  return regToFacts[regIdx];
+}
+
+//**********************************************************************
+// RDfactTable::size
+//**********************************************************************
+unsigned RDfactTable::size() const {
+  return facts.size();
+}
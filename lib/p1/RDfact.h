@@ -2,8 +2,17 @@
 // A RDfact is a pair (unsigned reg, MachineInstr * inst).
 // reg is the variable defined and inst is the instruction where it is
 // defined
+//
+// A RDfactTable interns the RDfacts of one function: each distinct
+// (reg, inst) pair gets a stable integer ID 0..size()-1, so that sets of
+// facts can be stored as BitSets, and the table keeps, for every
+// register, the list of IDs of the facts that define it (the facts
+// killed by a def of that register).
 //**********************************************************************
 
+#ifndef P1_RDFACT_H
+#define P1_RDFACT_H
+
 #include "llvm/CodeGen/Passes.h"
 #include "llvm/CodeGen/MachineFunctionPass.h"
 #include "llvm/CodeGen/MachineInstr.h"
@@ -18,6 +27,8 @@
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/Compiler.h"
 #include "llvm/ADT/Statistic.h"
+#include <map>
+#include <vector>
 
 using namespace std;
 using namespace llvm;
@@ -35,3 +46,27 @@ private:
   MachineInstr *myInstr;
 
 };
+
+class RDfactTable {
+public:
+
+  // forget all facts; registers are dense indexes 0..numRegs-1
+  void clear(unsigned numRegs);
+  // return the ID of fact (reg, inst), creating it if necessary;
+  // regIdx is reg's dense index
+  unsigned intern(unsigned reg, unsigned regIdx, MachineInstr *inst);
+  // return the ID of fact (reg, inst), which must already exist
+  unsigned lookup(unsigned reg, MachineInstr *inst) const;
+  RDfact &getFact(unsigned id);
+  // return the IDs of all facts for the reg with dense index regIdx
+  const std::vector<unsigned> &getFactsForReg(unsigned regIdx) const;
+  unsigned size() const;
+
+private:
+  std::vector<RDfact> facts;
+  std::vector<std::vector<unsigned> > regToFacts;
+  std::map<std::pair<unsigned, MachineInstr *>, unsigned> factIds;
+
+};
+
+#endif
@@ -42,6 +42,7 @@
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/Target/TargetInstrInfo.h"
 #include "llvm/CodeGen/MachineFrameInfo.h"
+#include "SlotColoring.h"
 
 using namespace llvm;
 
@@ -167,6 +168,12 @@ namespace {
         errs() << "\n";
       }
 
+      // Every def above got a fresh stack slot; let the ones that are
+      // never live at the same time share.
+      SpillSlotColoring slots(mf);
+      slots.run();
+      slots.report();
+
       return false;
     }
 
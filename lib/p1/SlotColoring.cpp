@@ -0,0 +1,328 @@
+#define DEBUG_TYPE "slotcoloring"
+#include "SlotColoring.h"
+#include "BitSet.h"
+#include "Arena.h"
+#include "DataFlow.h"
+#include "llvm/Function.h"
+#include "llvm/CodeGen/MachineFrameInfo.h"
+#include "llvm/CodeGen/MachineMemOperand.h"
+#include "llvm/CodeGen/PseudoSourceValue.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetInstrInfo.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/DenseMap.h"
+#include <algorithm>
+
+using namespace llvm;
+
+STATISTIC(NumSlotsMerged, "Number of spill slots merged into another");
+STATISTIC(NumBytesSaved,  "Number of spill-slot bytes removed from frames");
+
+static cl::opt<bool>
+SlotReport("p1-slot-report",
+           cl::desc("Print the spill-slot bytes of each frame before and "
+                    "after slot coloring"));
+
+namespace {
+  //**********************************************************************
+  // SlotNumbering
+  //
+  // dense indexes for the function's spill slots that are still in the
+  // frame, and the slots an instruction reads and writes
+  //**********************************************************************
+  class SlotNumbering {
+  public:
+    SlotNumbering(MachineFunction &Fn)
+      : MFI(*Fn.getFrameInfo()), TII(*Fn.getTarget().getInstrInfo()) {
+      begin = MFI.getObjectIndexBegin();
+      idx.assign(MFI.getObjectIndexEnd() - begin, -1);
+      for (int FI = begin, e = MFI.getObjectIndexEnd(); FI != e; ++FI)
+	if (MFI.isSpillSlotObjectIndex(FI) && !MFI.isDeadObjectIndex(FI)) {
+	  idx[FI - begin] = slots.size();
+	  slots.push_back(FI);
+	}
+    }
+
+    unsigned size() const { return slots.size(); }
+    int getSlot(unsigned i) const { return slots[i]; }
+
+    // the index of frame index FI, or -1 if it is not a spill slot
+    int getIdx(int FI) const {
+      if (FI < begin || FI - begin >= (int)idx.size())
+	return -1;
+      return idx[FI - begin];
+    }
+
+    // the slot inst stores to (a spill), or -1
+    int getDef(const MachineInstr *inst) const {
+      int FI;
+      if (!TII.isStoreToStackSlot(inst, FI))
+	return -1;
+      return getIdx(FI);
+    }
+
+    // call f(i) for each slot inst reads: every spill-slot operand that
+    // is not the slot of a recognized store
+    template<class F>
+    void forEachUse(const MachineInstr *inst, F &f) const {
+      int def = getDef(inst);
+      for (unsigned i = 0, e = inst->getNumOperands(); i != e; ++i) {
+	const MachineOperand &op = inst->getOperand(i);
+	if (!op.isFI())
+	  continue;
+	int s = getIdx(op.getIndex());
+	if (s != -1 && s != def)
+	  f(s);
+      }
+    }
+
+  private:
+    MachineFrameInfo &MFI;
+    const TargetInstrInfo &TII;
+    int begin;
+    vector<int> idx;      // by FI - begin
+    vector<int> slots;    // by index
+  };
+
+  struct SetBit {
+    BitSet &S;
+    SetBit(BitSet &s) : S(s) {}
+    void operator()(unsigned i) { S.set(i); }
+  };
+
+  struct CountRef {
+    vector<unsigned> &refs;
+    CountRef(vector<unsigned> &r) : refs(r) {}
+    void operator()(unsigned i) { refs[i]++; }
+  };
+
+  //**********************************************************************
+  // LiveSlotsProblem
+  //
+  // live spill slots: backward, union;
+  //   live-before = (live-after - def) union uses
+  //**********************************************************************
+  struct LiveSlotsProblem {
+    static const DataFlowDirection direction = BACKWARD;
+    static const DataFlowMeet meet = MEET_UNION;
+
+    const SlotNumbering &nums;
+    LiveSlotsProblem(const SlotNumbering &n) : nums(n) {}
+
+    unsigned getNumFacts() { return nums.size(); }
+
+    void getBlockGenKill(MachineBasicBlock *bb, BitSet &gen, BitSet &kill) {
+      for (MachineBasicBlock::iterator I = bb->end(), B = bb->begin();
+	   I != B; ) {
+	--I;
+	int d = nums.getDef(I);
+	if (d != -1) {
+	  gen.reset(d);
+	  kill.set(d);
+	}
+	SetBit useGen(gen);
+	nums.forEachUse(I, useGen);
+      }
+    }
+
+    void transfer(MachineInstr *inst, BitSet &live) {
+      int d = nums.getDef(inst);
+      if (d != -1)
+	live.reset(d);
+      SetBit use(live);
+      nums.forEachUse(inst, use);
+    }
+  };
+
+  typedef DataFlowGraph<MachineFunction> MachineGraph;
+
+  //**********************************************************************
+  // AddInterference
+  //
+  // refineBlock visitor: a store into a slot interferes with every other
+  // slot live after it
+  //**********************************************************************
+  struct AddInterference {
+    const SlotNumbering &nums;
+    vector<BitSet> &adj;
+    AddInterference(const SlotNumbering &n, vector<BitSet> &a)
+      : nums(n), adj(a) {}
+
+    void operator()(MachineInstr *inst, const BitSet &, const BitSet &after) {
+      int d = nums.getDef(inst);
+      if (d == -1)
+	return;
+      for (int s = after.findFirst(); s != -1; s = after.findNext(s))
+	if (s != d) {
+	  adj[d].set(s);
+	  adj[s].set(d);
+	}
+    }
+  };
+
+  //**********************************************************************
+  // BySizeAndUse
+  //
+  // coloring order: larger slots first, so that a color's slot is large
+  // enough for the slots that join it, then the most referenced
+  //**********************************************************************
+  struct BySizeAndUse {
+    const MachineFrameInfo &MFI;
+    const SlotNumbering &nums;
+    const vector<unsigned> &refs;
+    BySizeAndUse(const MachineFrameInfo &m, const SlotNumbering &n,
+		 const vector<unsigned> &r) : MFI(m), nums(n), refs(r) {}
+
+    bool operator()(unsigned a, unsigned b) const {
+      uint64_t sa = MFI.getObjectSize(nums.getSlot(a));
+      uint64_t sb = MFI.getObjectSize(nums.getSlot(b));
+      if (sa != sb)
+	return sa > sb;
+      if (refs[a] != refs[b])
+	return refs[a] > refs[b];
+      return a < b;
+    }
+  };
+}
+
+//**********************************************************************
+// run
+//
+// STEP 1: number the spill slots and count their references
+// STEP 2: find the live slots and build the interference graph
+// STEP 3: color the slots greedily
+// STEP 4: rewrite the frame indexes and remove the merged slots
+//**********************************************************************
+bool SpillSlotColoring::run() {
+  MachineFrameInfo *MFI = MF.getFrameInfo();
+
+  // STEP 1
+  SlotNumbering nums(MF);
+  numSlots = nums.size();
+  numRemoved = 0;
+  bytesBefore = bytesAfter = 0;
+  for (unsigned i = 0; i < numSlots; i++)
+    bytesBefore += MFI->getObjectSize(nums.getSlot(i));
+  bytesAfter = bytesBefore;
+  if (numSlots == 0)
+    return false;
+
+  vector<unsigned> refs(numSlots, 0);
+  CountRef count(refs);
+  for (MachineFunction::iterator bb = MF.begin(), be = MF.end();
+       bb != be; ++bb)
+    for (MachineBasicBlock::iterator I = bb->begin(), E = bb->end();
+	 I != E; ++I) {
+      int d = nums.getDef(I);
+      if (d != -1)
+	refs[d]++;
+      nums.forEachUse(I, count);
+    }
+
+  // STEP 2
+  Arena A;
+  MachineGraph graph(MF);
+  LiveSlotsProblem problem(nums);
+  DataFlow<MachineGraph, LiveSlotsProblem> DF(graph, problem, A);
+  DF.solve();
+
+  vector<BitSet> adj(numSlots, BitSet(numSlots, A));
+  AddInterference visitor(nums, adj);
+  for (MachineFunction::iterator bb = MF.begin(), be = MF.end();
+       bb != be; ++bb) {
+    DF.refineBlock(&*bb, visitor);
+    // slots live into a block nobody branches to were never stored to
+    // on the way in, so no store above makes them interfere
+    if (bb->pred_empty()) {
+      const BitSet &in = DF.getBefore(&*bb);
+      for (int s = in.findFirst(); s != -1; s = in.findNext(s))
+	adj[s].unionWith(in);
+    }
+  }
+
+  // STEP 3
+  vector<unsigned> order;
+  for (unsigned i = 0; i < numSlots; i++)
+    if (refs[i])
+      order.push_back(i);
+  stable_sort(order.begin(), order.end(), BySizeAndUse(*MFI, nums, refs));
+
+  vector<int> color(numSlots, -1);    // by index: the index it shares
+  vector<unsigned> leaders;           // the first slot of each color
+  vector<BitSet> members;             // by color
+  for (unsigned k = 0; k < order.size(); k++) {
+    unsigned s = order[k];
+    int FI = nums.getSlot(s);
+    for (unsigned c = 0; c < leaders.size() && color[s] == -1; c++) {
+      int leaderFI = nums.getSlot(leaders[c]);
+      if (MFI->getObjectSize(leaderFI) < MFI->getObjectSize(FI) ||
+	  MFI->getObjectAlignment(leaderFI) < MFI->getObjectAlignment(FI))
+	continue;
+      BitSet common(members[c]);
+      common.intersectWith(adj[s]);
+      if (!common.empty())
+	continue;
+      color[s] = leaders[c];
+      members[c].set(s);
+    }
+    if (color[s] == -1) {
+      color[s] = s;
+      leaders.push_back(s);
+      members.push_back(BitSet(numSlots, A));
+      members.back().set(s);
+    }
+  }
+
+  // STEP 4
+  bool changed = false;
+  DenseMap<const Value *, const Value *> newValue;
+  for (unsigned s = 0; s < numSlots; s++)
+    if (color[s] != -1 && color[s] != (int)s)
+      newValue[PseudoSourceValue::getFixedStack(nums.getSlot(s))] =
+	PseudoSourceValue::getFixedStack(nums.getSlot(color[s]));
+  for (MachineFunction::iterator bb = MF.begin(), be = MF.end();
+       bb != be; ++bb)
+    for (MachineBasicBlock::iterator I = bb->begin(), E = bb->end();
+	 I != E; ++I) {
+      for (unsigned i = 0, e = I->getNumOperands(); i != e; ++i) {
+	MachineOperand &op = I->getOperand(i);
+	if (!op.isFI())
+	  continue;
+	int s = nums.getIdx(op.getIndex());
+	if (s != -1 && color[s] != s) {
+	  op.setIndex(nums.getSlot(color[s]));
+	  changed = true;
+	}
+      }
+      // keep the memory operands in step, so that alias analysis does
+      // not think the sharers are independent
+      for (MachineInstr::mmo_iterator m = I->memoperands_begin(),
+	     me = I->memoperands_end(); m != me; ++m)
+	if (const Value *V = newValue.lookup((*m)->getValue()))
+	  (*m)->setValue(V);
+    }
+
+  for (unsigned s = 0; s < numSlots; s++)
+    if (color[s] != (int)s) {
+      bytesAfter -= MFI->getObjectSize(nums.getSlot(s));
+      MFI->RemoveStackObject(nums.getSlot(s));
+      numRemoved++;
+      changed = true;
+    }
+  NumSlotsMerged += numRemoved;
+  NumBytesSaved += bytesBefore - bytesAfter;
+  return changed;
+}
+
+//**********************************************************************
+// report
+//**********************************************************************
+void SpillSlotColoring::report() const {
+  if (!SlotReport)
+    return;
+  errs() << "slot coloring " << MF.getFunction()->getName() << ": "
+	 << numSlots << " spill slots, " << numRemoved << " removed, "
+	 << bytesBefore << " -> " << bytesAfter << " bytes\n";
+}
@@ -0,0 +1,57 @@
+//**********************************************************************
+// Spill-slot coloring.  The allocators give every spilled value a stack
+// slot of its own; a SpillSlotColoring, run once allocation is done,
+// merges the spill slots whose values are never live at the same time,
+// so that a frame needs only as many spill bytes as the values live at
+// once, and the slots that are used stay close together.
+//
+// A slot is live from a store into it to the loads from it, as found by
+// a backward dataflow over the function's spill slots: a load
+// (TargetInstrInfo::isLoadFromStackSlot) reads its slot, a store
+// (isStoreToStackSlot) writes all of it, and any other instruction
+// that names a slot (a folded memory operand) is taken to read it.
+// Two slots interfere if one is stored to while the other is live.
+// The slots are then colored greedily, largest and most used first; a
+// slot may share the slot of a color that is at least as large and as
+// aligned as it is.  Merged and unused slots are removed from the
+// frame.
+//
+// With -p1-slot-report, report() prints each function's spill bytes
+// before and after.
+//**********************************************************************
+
+#ifndef P1_SLOTCOLORING_H
+#define P1_SLOTCOLORING_H
+
+#include <stdint.h>
+
+namespace llvm {
+  class MachineFunction;
+}
+
+class SpillSlotColoring {
+public:
+  explicit SpillSlotColoring(llvm::MachineFunction &Fn)
+    : MF(Fn), numSlots(0), numRemoved(0), bytesBefore(0), bytesAfter(0) {}
+
+  // merge the slots; return true iff the function changed
+  bool run();
+
+  // spill slots in the frame before run(), and how many it removed
+  unsigned getNumSlots() const { return numSlots; }
+  unsigned getNumRemoved() const { return numRemoved; }
+
+  // bytes of spill slots in the frame before and after run()
+  uint64_t getBytesBefore() const { return bytesBefore; }
+  uint64_t getBytesAfter() const { return bytesAfter; }
+
+  // print the function's frame-size reduction, if -p1-slot-report
+  void report() const;
+
+private:
+  llvm::MachineFunction &MF;
+  unsigned numSlots, numRemoved;
+  uint64_t bytesBefore, bytesAfter;
+};
+
+#endif
@@ -0,0 +1,133 @@
+#include "Trace.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/System/TimeValue.h"
+
+using namespace llvm;
+
+static cl::opt<std::string>
+TraceFile("p1-trace", cl::value_desc("filename"),
+          cl::desc("Write a Chrome trace-event timeline of the P1 passes"));
+
+namespace {
+  //**********************************************************************
+  // TraceWriter
+  //
+  // The trace file: opened by the first span that ends, closed (and the
+  // JSON array terminated) when the tool exits.
+  //**********************************************************************
+  class TraceWriter {
+  public:
+    TraceWriter() : out(0), numEvents(0), failed(false) {}
+
+    ~TraceWriter() {
+      if (out) {
+        *out << "\n]\n";
+        delete out;
+      }
+    }
+
+    // could the file not be opened
+    bool hasFailed() const { return failed; }
+
+    // return the stream positioned for the next event, or 0
+    raw_ostream *getStream() {
+      if (!out) {
+        std::string error;
+        out = new raw_fd_ostream(TraceFile.c_str(), error);
+        if (!error.empty()) {
+          errs() << "error opening trace file '" << TraceFile << "': "
+                 << error << "\n";
+          delete out;
+          out = 0;
+          failed = true;
+          return 0;
+        }
+        *out << "[";
+      }
+      if (numEvents++)
+        *out << ",";
+      *out << "\n";
+      return out;
+    }
+
+  private:
+    raw_ostream *out;
+    unsigned numEvents;
+    bool failed;
+  };
+
+  TraceWriter writer;
+
+  uint64_t nowMicroseconds() {
+    sys::TimeValue now = sys::TimeValue::now();
+    return uint64_t(now.seconds()) * 1000000 + now.microseconds();
+  }
+
+  // write S as a JSON string
+  void writeString(raw_ostream &out, const std::string &S) {
+    out << "\"";
+    for (unsigned i = 0; i < S.size(); i++) {
+      unsigned char c = S[i];
+      if (c == '"' || c == '\\')
+        out << "\\" << S.substr(i, 1);
+      else if (c < 0x20)
+        out << "\\u00" << "0123456789abcdef"[c >> 4]
+            << "0123456789abcdef"[c & 15];
+      else
+        out << S.substr(i, 1);
+    }
+    out << "\"";
+  }
+}
+
+//**********************************************************************
+// constructor
+//**********************************************************************
+TraceSpan::TraceSpan(StringRef fn) : name(0), start(0) {
+  if (isEnabled())
+    function = fn.str();
+}
+
+//**********************************************************************
+// isEnabled
+//**********************************************************************
+bool TraceSpan::isEnabled() {
+  return !TraceFile.empty() && !writer.hasFailed();
+}
+
+//**********************************************************************
+// begin
+//**********************************************************************
+void TraceSpan::begin(const char *phase) {
+  end();
+  if (!isEnabled())
+    return;
+  name = phase;
+  args.clear();
+  start = nowMicroseconds();
+}
+
+//**********************************************************************
+// end
+//
+// write the open phase as a complete event named after the phase; the
+// function name goes in the arguments, so the viewer can search for it
+//**********************************************************************
+void TraceSpan::end() {
+  if (!name)
+    return;
+  uint64_t dur = nowMicroseconds() - start;
+  const char *phase = name;
+  name = 0;
+  raw_ostream *out = writer.getStream();
+  if (!out)
+    return;
+  *out << "{\"name\":\"" << phase << "\",\"cat\":\"p1\",\"ph\":\"X\""
+       << ",\"pid\":1,\"tid\":1,\"ts\":" << start << ",\"dur\":" << dur
+       << ",\"args\":{\"function\":";
+  writeString(*out, function);
+  for (unsigned i = 0; i < args.size(); i++)
+    *out << ",\"" << args[i].first << "\":" << args[i].second;
+  *out << "}}";
+}
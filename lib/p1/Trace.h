@@ -0,0 +1,52 @@
+//**********************************************************************
+// A TraceSpan records how long one phase of one pass took on one
+// function, for a timeline of a whole compile.  Spans are written to
+// the file named by -p1-trace=<file> in the Chrome trace-event JSON
+// format (open it in chrome://tracing or ui.perfetto.dev), one complete
+// ("X") event per span, with the span's arguments (instruction and
+// block counts, set sizes, ...) attached.
+//
+// Without -p1-trace, begin(), addArg() and end() do nothing but test a
+// flag, so the passes can leave their spans in unconditionally.
+//**********************************************************************
+
+#ifndef P1_TRACE_H
+#define P1_TRACE_H
+
+#include "llvm/ADT/StringRef.h"
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+class TraceSpan {
+public:
+  // spans of the function named fn
+  explicit TraceSpan(llvm::StringRef fn);
+  ~TraceSpan() { end(); }
+
+  // start the phase called name (a string literal); ends the open one
+  void begin(const char *name);
+
+  // attach key = value to the open phase (key is a string literal)
+  void addArg(const char *key, uint64_t value) {
+    if (name)
+      args.push_back(std::make_pair(key, value));
+  }
+
+  // end the open phase, if any, and write it out
+  void end();
+
+  // is -p1-trace on
+  static bool isEnabled();
+
+private:
+  std::string function;
+  const char *name;                 // the open phase, 0 if none
+  uint64_t start;                   // its start time in microseconds
+  std::vector<std::pair<const char *, uint64_t> > args;
+
+  TraceSpan(const TraceSpan &);     // do not implement
+  void operator=(const TraceSpan &); // do not implement
+};
+
+#endif
@@ -16,26 +16,84 @@
 #include <set>
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/Support/CFG.h"
+#include "DataFlow.h"
+#include "Trace.h"
 using namespace llvm;
 
 namespace {
   DenseMap<const Instruction*, int> instMap;
 
-  void print_elem(const Instruction* i) {
-    errs() << instMap.lookup(i) << " ";
-  }
-    
-  class genKill {
+  // Live variables over the instructions of one function (each
+  // instruction is the pseudo-register it defines), numbered densely so
+  // the sets can be BitSets for the DataFlow solver.
+  class LiveProblem {
   public:
-    std::set<const Instruction*> gen;
-    std::set<const Instruction*> kill;
+    static const DataFlowDirection direction = BACKWARD;
+    static const DataFlowMeet meet = MEET_UNION;
+
+    LiveProblem(Function &F) {
+      for (inst_iterator i = inst_begin(F), E = inst_end(F); i != E; ++i) {
+        factIdx.insert(std::make_pair(&*i, insts.size()));
+        insts.push_back(&*i);
+      }
+    }
+
+    unsigned getNumFacts() { return insts.size(); }
+    const Instruction *getInst(unsigned idx) { return insts[idx]; }
+
+    void getBlockGenKill(BasicBlock *b, BitSet &gen, BitSet &kill) {
+      for (BasicBlock::iterator i = b->begin(), e = b->end(); i != e; ++i) {
+        // The GEN set is the set of upwards-exposed uses:
+        // pseudo-registers that are used in the block before being
+        // defined. (Those will be the pseudo-registers that are defined
+        // in other blocks, or are defined in the current block and used
+        // in a phi function at the start of this block.) 
+        unsigned n = i->getNumOperands();
+        for (unsigned j = 0; j < n; j++) {
+          Value *v = i->getOperand(j);
+          if (isa<Instruction>(v)) {
+            unsigned op = factIdx.lookup(cast<Instruction>(v));
+            if (!kill.test(op))
+              gen.set(op);
+          }
+        }
+        // For the KILL set, you can use the set of all instructions
+        // that are in the block (which safely includes all of the
+        // pseudo-registers assigned to in the block).
+        kill.set(factIdx.lookup(&*i));
+      }
+    }
+
+    // before = after - KILL + GEN
+    void transfer(Instruction *i, BitSet &live) {
+      live.reset(factIdx.lookup(i));
+      unsigned n = i->getNumOperands();
+      for (unsigned j = 0; j < n; j++) {
+        Value *v = i->getOperand(j);
+        if (isa<Instruction>(v))
+          live.set(factIdx.lookup(cast<Instruction>(v)));
+      }
+    }
+
+  private:
+    std::vector<const Instruction*> insts;
+    DenseMap<const Instruction*, unsigned> factIdx;
   };
-  
+
+  // refineBlock visitor: keep each instruction's sets, by fact index
   class beforeAfter {
   public:
-    std::set<const Instruction*> before;
-    std::set<const Instruction*> after;
+    DenseMap<const Instruction*, std::pair<BitSet, BitSet> > sets;
+
+    void operator()(Instruction *i, const BitSet &before, const BitSet &after) {
+      sets[i] = std::make_pair(before, after);
+    }
   };
+
+  void print_set(LiveProblem &P, const BitSet &S) {
+    for (int idx = S.findFirst(); idx != -1; idx = S.findNext(idx))
+      errs() << instMap.lookup(P.getInst(idx)) << " ";
+  }
   
   class printCode : public FunctionPass {
   private:
@@ -46,102 +104,6 @@ namespace {
         // Convert the iterator to a pointer, and insert the pair
         instMap.insert(std::make_pair(&*i, id));
     }
-
-    void computeBBGenKill(Function &F, DenseMap<const BasicBlock*, genKill> &bbMap) 
-    {
-      for (Function::iterator b = F.begin(), e = F.end(); b != e; ++b) {
-        genKill s;
-        for (BasicBlock::iterator i = b->begin(), e = b->end(); i != e; ++i) {
-          // The GEN set is the set of upwards-exposed uses:
-          // pseudo-registers that are used in the block before being
-          // defined. (Those will be the pseudo-registers that are defined
-          // in other blocks, or are defined in the current block and used
-          // in a phi function at the start of this block.) 
-          unsigned n = i->getNumOperands();
-          for (unsigned j = 0; j < n; j++) {
-            Value *v = i->getOperand(j);
-            if (isa<Instruction>(v)) {
-              Instruction *op = cast<Instruction>(v);
-              if (!s.kill.count(op))
-                s.gen.insert(op);
-            }
-          }
-          // For the KILL set, you can use the set of all instructions
-          // that are in the block (which safely includes all of the
-          // pseudo-registers assigned to in the block).
-          s.kill.insert(&*i);
-        }
-        bbMap.insert(std::make_pair(&*b, s));
-      }
-    }
-
-    // Do this using a worklist algorithm (where the items in the worklist are basic blocks).
-    void computeBBBeforeAfter(Function &F, DenseMap<const BasicBlock*, genKill> &bbGKMap,
-                              DenseMap<const BasicBlock*, beforeAfter> &bbBAMap)
-    {
-      SmallVector<BasicBlock*, 32> workList;
-      workList.push_back(--F.end());
-
-      while (!workList.empty()) {
-        BasicBlock *b = workList.pop_back_val();
-        beforeAfter b_beforeAfter = bbBAMap.lookup(b);
-        bool shouldAddPred = !bbBAMap.count(b);
-        genKill b_genKill = bbGKMap.lookup(b);
-        
-        // Take the union of all successors
-        std::set<const Instruction*> a;
-        for (succ_iterator SI = succ_begin(b), E = succ_end(b); SI != E; ++SI) {
-          std::set<const Instruction*> s(bbBAMap.lookup(*SI).before);
-          a.insert(s.begin(), s.end());
-        }
-
-        if (a != b_beforeAfter.after){
-          shouldAddPred = true;
-          b_beforeAfter.after = a;
-          // before = after - KILL + GEN
-          b_beforeAfter.before.clear();
-          std::set_difference(a.begin(), a.end(), b_genKill.kill.begin(), b_genKill.kill.end(),
-                              std::inserter(b_beforeAfter.before, b_beforeAfter.before.end()));
-          b_beforeAfter.before.insert(b_genKill.gen.begin(), b_genKill.gen.end());
-        }
-        
-        if (shouldAddPred)
-          for (pred_iterator PI = pred_begin(b), E = pred_end(b); PI != E; ++PI)
-            workList.push_back(*PI);
-      }
-    }
-    
-    void computeIBeforeAfter(Function &F, DenseMap<const BasicBlock*, beforeAfter> &bbBAMap,
-                              DenseMap<const Instruction*, beforeAfter> &iBAMap)
-    {
-      for (Function::iterator b = F.begin(), e = F.end(); b != e; ++b) {
-        BasicBlock::iterator i = --b->end();
-        std::set<const Instruction*> liveAfter(bbBAMap.lookup(b).after);
-        std::set<const Instruction*> liveBefore(liveAfter);
-
-        while (true) {
-          // before = after - KILL + GEN
-          liveBefore.erase(i);
-
-          unsigned n = i->getNumOperands();
-          for (unsigned j = 0; j < n; j++) {
-            Value *v = i->getOperand(j);
-            if (isa<Instruction>(v))
-              liveBefore.insert(cast<Instruction>(v));
-          }
-
-          beforeAfter ba;
-          ba.before = liveBefore;
-          ba.after = liveAfter;
-          iBAMap.insert(std::make_pair(&*i, ba));
-
-          liveAfter = liveBefore;
-          if (i == b->begin())
-            break;
-          --i;
-        }
-      }
-    }
     
   public:
     static char ID; // Pass identification, replacement for typeid
@@ -158,28 +120,38 @@ namespace {
 
       // LLVM Value classes already have use information. But for the sake of learning, we will implement the iterative algorithm.
       
-      DenseMap<const BasicBlock*, genKill> bbGKMap;
-      // For each basic block in the function, compute the block's GEN and KILL sets.
-      computeBBGenKill(F, bbGKMap);
-
-      DenseMap<const BasicBlock*, beforeAfter> bbBAMap;
-      // For each basic block in the function, compute the block's liveBefore and liveAfter sets.
-      computeBBBeforeAfter(F, bbGKMap, bbBAMap);
-
-      DenseMap<const Instruction*, beforeAfter> iBAMap;
-      computeIBeforeAfter(F, bbBAMap, iBAMap);
-
+      TraceSpan span(F.getName());
+      span.begin("liveVars");
+
+      Arena arena;
+      DataFlowGraph<Function> graph(F);
+      LiveProblem problem(F);
+      DataFlow<DataFlowGraph<Function>, LiveProblem> live(graph, problem, arena);
+      // For each basic block in the function, compute the block's GEN and
+      // KILL sets, then its liveBefore and liveAfter sets.
+      live.solve();
+      span.addArg("instrs", problem.getNumFacts());
+      span.addArg("blocks", graph.getNumBlocks());
+      span.addArg("visits", live.getNumPops());
+
+      // Then each instruction's liveBefore and liveAfter sets.
+      beforeAfter iBAMap;
+      for (Function::iterator b = F.begin(), e = F.end(); b != e; ++b)
+        live.refineBlock(b, iBAMap);
+
+      // total size of the before and after sets, for the trace
+      unsigned setBits = 0;
       for (inst_iterator i = inst_begin(F), E = inst_end(F); i != E; ++i) {
-        beforeAfter s = iBAMap.lookup(&*i);
+        std::pair<BitSet, BitSet> &s = iBAMap.sets[&*i];
+        if (TraceSpan::isEnabled())
+          setBits += s.first.count() + s.second.count();
         errs() << "%" << instMap.lookup(&*i) << ": { ";
-        std::for_each(s.before.begin(), s.before.end(), print_elem);
+        print_set(problem, s.first);
         errs() << "} { ";
-        std::for_each(s.after.begin(), s.after.end(), print_elem);
+        print_set(problem, s.second);
         errs() << "}\n";
       }
-
-
-
+      span.addArg("setbits", setBits);
 
       return changed;
     }
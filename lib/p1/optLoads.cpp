@@ -25,6 +25,7 @@
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/User.h"
 #include "llvm/Instructions.h"
+#include "Trace.h"
 using namespace llvm;
 
 namespace {
@@ -50,6 +51,13 @@ namespace {
       // Iterate over the instructions in F, creating a map from instruction address to unique integer.
       addToMap(F);
 
+      TraceSpan span(F.getName());
+      span.begin("optLoads");
+      if (TraceSpan::isEnabled())
+        span.addArg("instrs", countInstructions(F));
+      span.addArg("blocks", F.size());
+      unsigned removed = 0;
+
       bool changed = false;
       // Iterate over all basic blocks in the function, and all
       // instructions in each basic block.
@@ -74,15 +82,24 @@ namespace {
                 k->replaceAllUsesWith(v);
                 k->eraseFromParent();
                 changed = true;
+                removed++;
               }
             }
           }
           else
             ++i;
         }
+      span.addArg("removed", removed);
       return changed;
     }
 
+    unsigned countInstructions(Function &F) {
+      unsigned n = 0;
+      for (inst_iterator i = inst_begin(F), E = inst_end(F); i != E; ++i)
+        n++;
+      return n;
+    }
+
     //**********************************************************************
     // print (do not change this method)
     //
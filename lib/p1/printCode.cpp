@@ -24,6 +24,7 @@
 #include "llvm/Support/InstIterator.h"
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/User.h"
+#include "Trace.h"
 using namespace llvm;
 
 namespace {
@@ -46,6 +47,10 @@ namespace {
     // runOnFunction
     //**********************************************************************
     virtual bool runOnFunction(Function &F) {
+      TraceSpan span(F.getName());
+      span.begin("printCode");
+      unsigned numInstrs = 0;
+
       // print fn name
       errs() << "FUNCTION " << F.getName() << "\n";
 
@@ -60,6 +65,7 @@ namespace {
         errs() << "\nBASIC BLOCK " << b->getName() << "\n";
         for (BasicBlock::iterator i = b->begin(), e = b->end(); i != e; ++i) {
           int id = instMap.lookup(&*i);
+          numInstrs++;
           errs() << "%" << id << ":\t" << i->getOpcodeName() << "\t";
           unsigned n = i->getNumOperands();
           for (unsigned j = 0; j < n; j++) {
@@ -78,6 +84,8 @@ namespace {
         }
       }
 
+      span.addArg("instrs", numInstrs);
+      span.addArg("blocks", F.size());
       return false;  // because we have NOT changed this function
     }
 
@@ -0,0 +1,266 @@
+#!/usr/bin/env python
+#
+# bench.py - time the phases of the graph-coloring register allocator
+# on synthetic functions of increasing size.
+#
+# For each size, genIR.py generates a function, llvm-as assembles it,
+# and llc -regalloc=gc compiles it with -time-passes and -stats.  One
+# row per size is printed with the wall time of each Gcra step (from
+# the "Graph-coloring register allocation" timer group), the Gcra
+# statistics, the peak resident memory of llc and its total time,
+# followed by the slope of log(time) over log(size) for each step
+# between consecutive sizes (about 1 for a linear step, 2 for a
+# quadratic one).
+#
+# Gcra switches big functions to linear scan (-gcra-linear-scan-instrs,
+# -gcra-linear-scan-vregs, -gcra-time-budget), which would cut the
+# coloring curves short; the script lifts those limits unless
+# --fallback is given.  Each row's "mode" column says how the function
+# was allocated (coloring, regions or linearscan), and no slope is
+# computed between rows of different modes.
+#
+# With --save the rows are written as CSV; with --compare an earlier
+# CSV is read back, and the script exits with status 1 if any step got
+# slower than --tolerance at any size both runs have.
+#
+# Example (from the top directory, after building Debug):
+#   make bench
+#   tests/bench/bench.py --lib Debug/lib/P1.so --sizes 10,100,1000 \
+#       --depth 3 --calls 0.1 --save before.csv
+
+from __future__ import print_function
+import csv
+import math
+import optparse
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+GROUP = 'Graph-coloring register allocation'
+
+# genIR.py options passed through unchanged
+GEN_OPTS = ['blocks', 'depth', 'pressure', 'calls', 'fanout', 'seed']
+
+# llc options that keep Gcra coloring at every size (see --fallback)
+NO_FALLBACK = ['-gcra-linear-scan-instrs=4000000000',
+               '-gcra-linear-scan-vregs=4000000000',
+               '-gcra-time-budget=0']
+
+# the gcra statistic counting the functions allocated in each mode
+MODE_STATS = [('linearscan', 'Number of functions allocated by linear scan'),
+              ('regions', 'Number of functions colored region by region'),
+              ('coloring', 'Number of functions allocated by graph coloring')]
+
+
+def run(cmd, stdout=None):
+    """Run cmd; return (status, stderr text, peak RSS of the child in KB)."""
+    p = subprocess.Popen(cmd, stdout=stdout, stderr=subprocess.PIPE,
+                         universal_newlines=True)
+    err = p.stderr.read()
+    p.stderr.close()
+    # wait4 gives the rusage of this child alone
+    pid, status, usage = os.wait4(p.pid, 0)
+    p.returncode = status
+    return status, err, usage.ru_maxrss
+
+
+def parseTimers(text):
+    """Return {step name: wall seconds} for the Gcra timer group."""
+    times = {}
+    inGroup = False
+    for line in text.splitlines():
+        if line.strip() == GROUP:
+            inGroup = True
+            continue
+        if not inGroup:
+            continue
+        if line.startswith('===') and times:
+            break
+        cols = re.findall(r'([\d.]+) \(\s*[\d.]+%\)', line)
+        name = re.sub(r'^\s*(?:[\d.]+ \(\s*[\d.]+%\)\s*)+', '', line).strip()
+        if cols and name and name != 'Total':
+            # the last column is the wall time
+            times[name] = float(cols[-1])
+    return times
+
+
+def parseStats(text):
+    """Return {description: count} for the gcra statistics."""
+    stats = {}
+    for line in text.splitlines():
+        m = re.match(r'^\s*(\d+)\s+gcra\s+-\s+(.*)$', line)
+        if m:
+            stats[m.group(2).strip()] = int(m.group(1))
+    return stats
+
+
+def measure(opts, size, workdir):
+    ll = os.path.join(workdir, 'bench%d.ll' % size)
+    bc = os.path.join(workdir, 'bench%d.bc' % size)
+    gen = [sys.executable, os.path.join(HERE, 'genIR.py'),
+           '--instrs', str(size)]
+    for o in GEN_OPTS:
+        gen += ['--' + o, str(getattr(opts, o))]
+    out = open(ll, 'w')
+    status, err, rss = run(gen, stdout=out)
+    out.close()
+    if status:
+        sys.exit('genIR.py failed:\n' + err)
+    status, err, rss = run([opts.llvmas, ll, '-o', bc])
+    if status:
+        sys.exit('llvm-as failed:\n' + err)
+
+    # the plugin's own options are only known after -load
+    llc = [opts.llc, '-load', opts.lib, '-regalloc=gc', '-time-passes',
+           '-stats', '-o', os.devnull]
+    if not opts.fallback:
+        llc += NO_FALLBACK
+    llc.append(bc)
+    if opts.trace:
+        llc.append('-p1-trace=' + os.path.join(workdir, 'bench%d.json' % size))
+    status, err, rss = run(llc)
+    if status:
+        sys.exit('llc failed on %s:\n%s' % (bc, err))
+
+    row = {'instrs': size, 'peak_rss_kb': rss}
+    for name, t in parseTimers(err).items():
+        row[name] = t
+    stats = parseStats(err)
+    for name, n in stats.items():
+        row[name] = n
+    row['mode'] = next((m for m, stat in MODE_STATS if stats.get(stat)), '?')
+    m = re.search(r'Total Execution Time: [\d.]+ seconds \(([\d.]+) wall', err)
+    row['llc_wall'] = float(m.group(1)) if m else 0.0
+    return row
+
+
+def columns(rows):
+    cols = ['instrs', 'mode']
+    for r in rows:
+        for k in sorted(r):
+            if k not in cols:
+                cols.append(k)
+    return cols
+
+
+def printTable(rows, cols):
+    widths = [max(len(c), 10) for c in cols]
+    print('  '.join(c.rjust(w) for c, w in zip(cols, widths)))
+    for r in rows:
+        cells = []
+        for c, w in zip(cols, widths):
+            v = r.get(c, '')
+            cells.append(('%.4f' % v if isinstance(v, float) else str(v)).rjust(w))
+        print('  '.join(cells))
+
+
+def printSlopes(rows, steps):
+    print('\nlog-log slope of wall time between consecutive sizes')
+    for s in steps:
+        slopes = []
+        for a, b in zip(rows, rows[1:]):
+            ta, tb = a.get(s, 0), b.get(s, 0)
+            if ta > 0 and tb > 0 and a['mode'] == b['mode']:
+                slopes.append('%.2f' % (math.log(tb / ta) /
+                                        math.log(float(b['instrs']) / a['instrs'])))
+            else:
+                slopes.append('-')
+        print('  %-36s %s' % (s, ' '.join(slopes)))
+
+
+def compare(rows, steps, baseline, tolerance, minTime):
+    """Return the steps (and sizes) that got slower than the baseline."""
+    old = {}
+    f = open(baseline)
+    for r in csv.DictReader(f):
+        old[int(r['instrs'])] = r
+    f.close()
+    worse = []
+    for r in rows:
+        o = old.get(r['instrs'])
+        if not o:
+            continue
+        for s in steps:
+            if not o.get(s) or s not in r:
+                continue
+            before, after = float(o[s]), r[s]
+            if after > minTime and after > before * (1 + tolerance):
+                worse.append('%s at %d instrs: %.4fs -> %.4fs' %
+                             (s, r['instrs'], before, after))
+    return worse
+
+
+def main():
+    parser = optparse.OptionParser(usage='%prog --lib P1.so [options]')
+    parser.add_option('--lib', help='the P1 library to load into llc')
+    parser.add_option('--llc', default='llc', help='llc to run [%default]')
+    parser.add_option('--llvm-as', dest='llvmas', default='llvm-as',
+                      help='llvm-as to run [%default]')
+    parser.add_option('--sizes', default='10,100,1000,10000,100000',
+                      help='comma-separated instruction counts [%default]')
+    parser.add_option('--blocks', type='int', default=4)
+    parser.add_option('--depth', type='int', default=2)
+    parser.add_option('--pressure', type='int', default=16)
+    parser.add_option('--calls', type='float', default=0.02)
+    parser.add_option('--fanout', type='int', default=4)
+    parser.add_option('--seed', type='int', default=701)
+    parser.add_option('--fallback', action='store_true',
+                      help="keep Gcra's default switch to linear scan for "
+                      'big functions')
+    parser.add_option('--trace', action='store_true',
+                      help='also write a -p1-trace timeline per size')
+    parser.add_option('--keep', action='store_true',
+                      help='keep the generated files (printed at the end)')
+    parser.add_option('--save', metavar='CSV', help='write the rows as CSV')
+    parser.add_option('--compare', metavar='CSV',
+                      help='fail if a step got slower than in this CSV')
+    parser.add_option('--tolerance', type='float', default=0.25,
+                      help='allowed slowdown for --compare [%default]')
+    parser.add_option('--min-time', dest='minTime', type='float', default=0.01,
+                      help='ignore steps faster than this many seconds '
+                      'in --compare [%default]')
+    opts, args = parser.parse_args()
+    if args or not opts.lib:
+        parser.error('--lib is required')
+
+    sizes = [int(s) for s in opts.sizes.split(',')]
+    workdir = tempfile.mkdtemp(prefix='gcra-bench')
+    try:
+        rows = []
+        for size in sizes:
+            rows.append(measure(opts, size, workdir))
+            print('measured %d instrs' % size, file=sys.stderr)
+    finally:
+        if opts.keep:
+            print('generated files are in ' + workdir, file=sys.stderr)
+        else:
+            shutil.rmtree(workdir)
+
+    cols = columns(rows)
+    steps = sorted(set(k for r in rows for k in r
+                       if isinstance(r[k], float)))
+    printTable(rows, cols)
+    printSlopes(rows, steps)
+
+    if opts.save:
+        f = open(opts.save, 'w')
+        w = csv.DictWriter(f, cols)
+        w.writerow(dict(zip(cols, cols)))
+        w.writerows(rows)
+        f.close()
+
+    if opts.compare:
+        worse = compare(rows, steps, opts.compare, opts.tolerance, opts.minTime)
+        if worse:
+            print('\nslower than %s:' % opts.compare)
+            for w in worse:
+                print('  ' + w)
+            sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
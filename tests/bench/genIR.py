@@ -0,0 +1,231 @@
+#!/usr/bin/env python
+#
+# genIR.py - generate a synthetic LLVM assembly (.ll) function for
+# stressing the register allocator.
+#
+# The function @bench(i32 %n, i32 %seed) is a sequence of regions.  Each
+# region is a loop nest of the given depth whose innermost body is a
+# chain of straight-line blocks, optionally entered through a switch of
+# the given fan-out.  The body computes an accumulator from "pressure"
+# values that are defined in the entry block and all used again in the
+# exit block, so that many vregs are live across every loop; a fraction
+# of the body instructions are calls to an external function, which
+# clobber the caller-saved registers.
+#
+# Example:
+#   ./genIR.py --instrs 10000 --depth 2 --pressure 24 --calls 0.05 \
+#              --fanout 8 > f.ll
+#   llvm-as f.ll -o f.bc
+
+from __future__ import print_function
+import optparse
+import random
+import sys
+
+
+class Function(object):
+    def __init__(self):
+        self.blocks = []        # [label, [instruction lines]]
+        self.numValues = 0
+        self.numInstrs = 0
+
+    def value(self, prefix='v'):
+        self.numValues += 1
+        return '%%%s%d' % (prefix, self.numValues)
+
+    def label(self, prefix):
+        self.numValues += 1
+        return '%s%d' % (prefix, self.numValues)
+
+    def startBlock(self, label):
+        self.blocks.append([label, []])
+
+    def emit(self, line):
+        self.blocks[-1][1].append(line)
+        self.numInstrs += 1
+
+    def curLabel(self):
+        return self.blocks[-1][0]
+
+    def text(self):
+        lines = []
+        for label, insts in self.blocks:
+            lines.append('%s:' % label)
+            lines.extend('  ' + i for i in insts)
+        return '\n'.join(lines)
+
+
+class Generator(object):
+    OPS = ['add', 'sub', 'mul', 'xor', 'and', 'or']
+
+    def __init__(self, opts):
+        self.opts = opts
+        self.rand = random.Random(opts.seed)
+        self.F = Function()
+        self.pressure = []
+
+    # one body instruction combining acc with a pressure value
+    def emitOp(self, acc):
+        F = self.F
+        if self.rand.random() < self.opts.calls:
+            v = F.value('c')
+            F.emit('%s = call i32 @ext(i32 %s)' % (v, acc))
+            return v
+        op = self.rand.choice(self.OPS)
+        other = self.rand.choice(self.pressure) if self.pressure else '%seed'
+        v = F.value()
+        F.emit('%s = %s i32 %s, %s' % (v, op, acc, other))
+        return v
+
+    # a switch on acc with fanout cases that merge again
+    def emitSwitch(self, acc):
+        F, fanout = self.F, self.opts.fanout
+        sel = F.value('s')
+        F.emit('%s = and i32 %s, %d' % (sel, acc, fanout * 2 - 1))
+        cases = [F.label('case') for i in range(fanout)]
+        default = F.label('default')
+        merge = F.label('merge')
+        F.emit('switch i32 %s, label %%%s [ %s ]' %
+               (sel, default, ' '.join('i32 %d, label %%%s' % (i, c)
+                                       for i, c in enumerate(cases))))
+        incoming = []
+        for i, c in enumerate(cases + [default]):
+            F.startBlock(c)
+            v = F.value()
+            F.emit('%s = add i32 %s, %d' % (v, acc, i + 1))
+            F.emit('br label %%%s' % merge)
+            incoming.append((v, c))
+        F.startBlock(merge)
+        v = F.value('m')
+        F.emit('%s = phi i32 %s' %
+               (v, ', '.join('[ %s, %%%s ]' % p for p in incoming)))
+        return v
+
+    # the innermost loop body: bodyInstrs instructions over nblocks blocks
+    def emitBody(self, acc, bodyInstrs):
+        F = self.F
+        if self.opts.fanout > 0:
+            acc = self.emitSwitch(acc)
+        nblocks = max(1, self.opts.blocks)
+        perBlock = max(1, bodyInstrs // nblocks)
+        for b in range(nblocks):
+            for i in range(perBlock):
+                acc = self.emitOp(acc)
+            if b + 1 < nblocks:
+                next = F.label('body')
+                F.emit('br label %%%s' % next)
+                F.startBlock(next)
+        return acc
+
+    # a loop nest from level down to opts.depth around a body; the
+    # current block falls into it, and the caller continues in the exit
+    def emitLoop(self, level, acc, bodyInstrs):
+        F = self.F
+        pred = F.curLabel()
+        header = F.label('header')
+        body = F.label('loop')
+        latch = F.label('latch')
+        exit = F.label('exit')
+        F.emit('br label %%%s' % header)
+
+        F.startBlock(header)
+        i, accPhi = F.value('i'), F.value('a')
+        header_lines = F.blocks[-1][1]
+        # the phis are patched in once the latch values are known
+        header_lines.append(None)
+        header_lines.append(None)
+        F.numInstrs += 2
+        cond = F.value('cond')
+        F.emit('%s = icmp slt i32 %s, %%n' % (cond, i))
+        F.emit('br i1 %s, label %%%s, label %%%s' % (cond, body, exit))
+
+        F.startBlock(body)
+        if level < self.opts.depth:
+            out = self.emitLoop(level + 1, accPhi, bodyInstrs)
+        else:
+            out = self.emitBody(accPhi, bodyInstrs)
+        F.emit('br label %%%s' % latch)
+
+        F.startBlock(latch)
+        inext = F.value('inext')
+        F.emit('%s = add i32 %s, 1' % (inext, i))
+        F.emit('br label %%%s' % header)
+
+        header_lines[0] = '%s = phi i32 [ 0, %%%s ], [ %s, %%%s ]' % (
+            i, pred, inext, latch)
+        header_lines[1] = '%s = phi i32 [ %s, %%%s ], [ %s, %%%s ]' % (
+            accPhi, acc, pred, out, latch)
+
+        F.startBlock(exit)
+        return accPhi
+
+    def generate(self):
+        opts, F = self.opts, self.F
+        F.startBlock('entry')
+        for k in range(opts.pressure):
+            v = F.value('p')
+            F.emit('%s = add i32 %%seed, %d' % (v, k * 7 + 1))
+            self.pressure.append(v)
+
+        # per-region overhead: loop control plus the switch
+        overhead = 6 * max(1, opts.depth) + (2 * opts.fanout + 4 if opts.fanout else 0)
+        budget = max(1, opts.instrs - 2 * opts.pressure)
+        regions = opts.regions or max(1, budget // (overhead + max(8, opts.bodySize)))
+        bodyInstrs = max(1, budget // regions - overhead)
+
+        acc = '%seed'
+        for r in range(regions):
+            if opts.depth > 0:
+                acc = self.emitLoop(1, acc, bodyInstrs)
+            else:
+                acc = self.emitBody(acc, bodyInstrs)
+
+        # keep every pressure value live to the end
+        for p in self.pressure:
+            v = F.value()
+            F.emit('%s = add i32 %s, %s' % (v, acc, p))
+            acc = v
+        F.emit('ret i32 %s' % acc)
+
+        return '\n'.join([
+            '; generated by genIR.py %s' % ' '.join(sys.argv[1:]),
+            '; %d instructions, %d blocks' % (F.numInstrs, len(F.blocks)),
+            'declare i32 @ext(i32)',
+            '',
+            'define i32 @bench(i32 %n, i32 %seed) nounwind {',
+            F.text(),
+            '}',
+            ''])
+
+
+def main():
+    parser = optparse.OptionParser(usage='%prog [options] > out.ll')
+    parser.add_option('--instrs', type='int', default=1000,
+                      help='approximate number of instructions [%default]')
+    parser.add_option('--blocks', type='int', default=4,
+                      help='straight-line blocks per loop body [%default]')
+    parser.add_option('--depth', type='int', default=2,
+                      help='loop nesting depth (0 = no loops) [%default]')
+    parser.add_option('--pressure', type='int', default=16,
+                      help='values live across every loop [%default]')
+    parser.add_option('--calls', type='float', default=0.02,
+                      help='fraction of body instructions that are calls '
+                      '[%default]')
+    parser.add_option('--fanout', type='int', default=4,
+                      help='switch cases per loop body (0 = none) [%default]')
+    parser.add_option('--regions', type='int', default=0,
+                      help='number of loop nests (0 = from --body-size) '
+                      '[%default]')
+    parser.add_option('--body-size', dest='bodySize', type='int', default=64,
+                      help='instructions per loop body when --regions is 0 '
+                      '[%default]')
+    parser.add_option('--seed', type='int', default=701,
+                      help='random seed [%default]')
+    opts, args = parser.parse_args()
+    if args:
+        parser.error('unexpected arguments')
+    sys.stdout.write(Generator(opts).generate())
+
+
+if __name__ == '__main__':
+    main()